@@ -24,16 +24,22 @@
 #include <gtc/matrix_transform.hpp>
 #include <gtx/euler_angles.hpp>
 #include <memory>
+#include <functional>
 #include <map>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <deque>
 #include <array>
 #include <algorithm>
 #include <numeric>
 #include <string>
+#include <cstring>
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -1 +1,9 @@
-#include "attributes.h"
\ No newline at end of file
+#include "attributes.h"
+
+glm::quat Transform::orientation() const {
+	glm::vec3 axis = glm::vec3(rotation);
+	float norm = glm::length(axis);
+	if (norm == 0)
+		return glm::quat(1, 0, 0, 0);
+	return glm::angleAxis(glm::radians(rotation.w / norm), axis / norm);
+}
\ No newline at end of file
@@ -5,4 +5,14 @@ struct Transform {
 	glm::vec3 position = { 0, 0, 0 };
 	glm::vec4 rotation = { 0, 0, 0, 0 };
 	glm::vec3 size = { 1, 1, 1 };
+
+	// rotation as a quaternion, the same way rotatePoint() in Vertex.txt reads it
+	glm::quat orientation() const;
+
+	bool operator==(const Transform& other) const {
+		return position == other.position && rotation == other.rotation && size == other.size;
+	}
+	bool operator!=(const Transform& other) const {
+		return !(*this == other);
+	}
 };
\ No newline at end of file
@@ -0,0 +1,244 @@
+#include "blockCompression.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BLOCKS_SSE2
+#endif
+
+namespace Cooked {
+	namespace {
+		uint16_t to565(const uint8_t* color) {
+			return (uint16_t)((color[0] >> 3) << 11 | (color[1] >> 2) << 5 | color[2] >> 3);
+		}
+		void from565(uint16_t packed, uint8_t* color) {
+			uint8_t r = packed >> 11, g = (packed >> 5) & 63, b = packed & 31;
+			color[0] = (uint8_t)(r << 3 | r >> 2);
+			color[1] = (uint8_t)(g << 2 | g >> 4);
+			color[2] = (uint8_t)(b << 3 | b >> 2);
+			color[3] = 0;
+		}
+
+		// van Waveren's real-time DXT: the bounding box of the block's colors, inset by 1/16 of its size
+		// against the rounding to the endpoints, then every texel gets the closest of the 4 palette colors
+		void boundingBox(const uint8_t* block, uint8_t* min, uint8_t* max) {
+#if defined(BLOCKS_SSE2)
+			__m128i low = _mm_loadu_si128((const __m128i*)block);
+			__m128i high = low;
+			for (int row = 1; row < 4; row++) {
+				__m128i texels = _mm_loadu_si128((const __m128i*)(block + row * 16));
+				low = _mm_min_epu8(low, texels);
+				high = _mm_max_epu8(high, texels);
+			}
+			// fold the 4 texels of a row onto the first one
+			low = _mm_min_epu8(low, _mm_srli_si128(low, 8));
+			low = _mm_min_epu8(low, _mm_srli_si128(low, 4));
+			high = _mm_max_epu8(high, _mm_srli_si128(high, 8));
+			high = _mm_max_epu8(high, _mm_srli_si128(high, 4));
+			int lowBits = _mm_cvtsi128_si32(low);
+			int highBits = _mm_cvtsi128_si32(high);
+			std::memcpy(min, &lowBits, 4);
+			std::memcpy(max, &highBits, 4);
+#else
+			for (int channel = 0; channel < 4; channel++) {
+				min[channel] = 255;
+				max[channel] = 0;
+			}
+			for (int i = 0; i < 16; i++) {
+				for (int channel = 0; channel < 4; channel++) {
+					min[channel] = std::min(min[channel], block[i * 4 + channel]);
+					max[channel] = std::max(max[channel], block[i * 4 + channel]);
+				}
+			}
+#endif
+		}
+		// 2 bit palette index of every texel, nearest by squared RGB distance
+		uint32_t colorIndices(const uint8_t* block, const uint8_t palette[4][4]) {
+			int indices[16];
+#if defined(BLOCKS_SSE2)
+			__m128i zero = _mm_setzero_si128();
+			__m128i rgbMask = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+			__m128i colors[4];
+			for (int i = 0; i < 4; i++)
+				colors[i] = _mm_set_epi16(0, palette[i][2], palette[i][1], palette[i][0], 0, palette[i][2], palette[i][1], palette[i][0]);
+			for (int row = 0; row < 4; row++) {
+				__m128i texels = _mm_loadu_si128((const __m128i*)(block + row * 16));
+				__m128i low = _mm_and_si128(_mm_unpacklo_epi8(texels, zero), rgbMask);
+				__m128i high = _mm_and_si128(_mm_unpackhi_epi8(texels, zero), rgbMask);
+				__m128i best = _mm_set1_epi32(INT32_MAX);
+				__m128i bestIndex = zero;
+				for (int i = 0; i < 4; i++) {
+					// r*r + g*g and b*b per texel from madd, then the two halves added
+					__m128i lowDelta = _mm_sub_epi16(low, colors[i]);
+					__m128i highDelta = _mm_sub_epi16(high, colors[i]);
+					__m128 lowSquares = _mm_castsi128_ps(_mm_madd_epi16(lowDelta, lowDelta));
+					__m128 highSquares = _mm_castsi128_ps(_mm_madd_epi16(highDelta, highDelta));
+					__m128i distance = _mm_add_epi32(
+						_mm_castps_si128(_mm_shuffle_ps(lowSquares, highSquares, _MM_SHUFFLE(2, 0, 2, 0))),
+						_mm_castps_si128(_mm_shuffle_ps(lowSquares, highSquares, _MM_SHUFFLE(3, 1, 3, 1))));
+					__m128i closer = _mm_cmplt_epi32(distance, best);
+					best = _mm_or_si128(_mm_and_si128(closer, distance), _mm_andnot_si128(closer, best));
+					bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(i)), _mm_andnot_si128(closer, bestIndex));
+				}
+				_mm_storeu_si128((__m128i*)(indices + row * 4), bestIndex);
+			}
+#else
+			for (int t = 0; t < 16; t++) {
+				int best = INT32_MAX;
+				for (int i = 0; i < 4; i++) {
+					int distance = 0;
+					for (int channel = 0; channel < 3; channel++) {
+						int delta = block[t * 4 + channel] - palette[i][channel];
+						distance += delta * delta;
+					}
+					if (distance < best) {
+						best = distance;
+						indices[t] = i;
+					}
+				}
+			}
+#endif
+			uint32_t packed = 0;
+			for (int t = 0; t < 16; t++)
+				packed |= (uint32_t)indices[t] << (t * 2);
+			return packed;
+		}
+		void encodeColors(const uint8_t* block, uint8_t* out) {
+			uint8_t min[4], max[4];
+			boundingBox(block, min, max);
+			for (int channel = 0; channel < 3; channel++) {
+				int inset = (max[channel] - min[channel]) >> 4;
+				min[channel] = (uint8_t)std::min(min[channel] + inset, 255);
+				max[channel] = (uint8_t)std::max(max[channel] - inset, 0);
+			}
+			// the box has 4 diagonals, channels that fall while the widest one rises swap their ends
+			int widest = 0;
+			for (int channel = 1; channel < 3; channel++) {
+				if (max[channel] - min[channel] > max[widest] - min[widest])
+					widest = channel;
+			}
+			for (int channel = 0; channel < 3; channel++) {
+				if (channel == widest)
+					continue;
+				int covariance = 0;
+				for (int t = 0; t < 16; t++)
+					covariance += (block[t * 4 + widest] * 2 - min[widest] - max[widest]) * (block[t * 4 + channel] * 2 - min[channel] - max[channel]);
+				if (covariance < 0)
+					std::swap(min[channel], max[channel]);
+			}
+			uint16_t color0 = to565(max);
+			uint16_t color1 = to565(min);
+			// color0 > color1 selects the 4 color mode, equal endpoints leave every index at 0
+			if (color0 < color1)
+				std::swap(color0, color1);
+			uint32_t indices = 0;
+			if (color0 != color1) {
+				uint8_t palette[4][4];
+				from565(color0, palette[0]);
+				from565(color1, palette[1]);
+				for (int channel = 0; channel < 3; channel++) {
+					palette[2][channel] = (uint8_t)((2 * palette[0][channel] + palette[1][channel]) / 3);
+					palette[3][channel] = (uint8_t)((palette[0][channel] + 2 * palette[1][channel]) / 3);
+				}
+				indices = colorIndices(block, palette);
+			}
+			std::memcpy(out, &color0, 2);
+			std::memcpy(out + 2, &color1, 2);
+			std::memcpy(out + 4, &indices, 4);
+		}
+		void encodeAlpha(const uint8_t* block, uint8_t* out) {
+			int min = 255, max = 0;
+			for (int t = 0; t < 16; t++) {
+				min = std::min<int>(min, block[t * 4 + 3]);
+				max = std::max<int>(max, block[t * 4 + 3]);
+			}
+			int inset = (max - min) >> 5;
+			min += inset;
+			max -= inset;
+			// alpha0 > alpha1 selects the 8 value mode, 6 of them interpolated
+			int alpha0 = max, alpha1 = min;
+			int palette[8] = { alpha0, alpha1 };
+			for (int i = 1; i < 7; i++)
+				palette[i + 1] = ((7 - i) * alpha0 + i * alpha1) / 7;
+			uint64_t indices = 0;
+			if (alpha0 != alpha1) {
+				for (int t = 0; t < 16; t++) {
+					int alpha = block[t * 4 + 3];
+					int best = 0;
+					for (int i = 1; i < 8; i++) {
+						if (std::abs(palette[i] - alpha) < std::abs(palette[best] - alpha))
+							best = i;
+					}
+					indices |= (uint64_t)best << (t * 3);
+				}
+			}
+			out[0] = (uint8_t)alpha0;
+			out[1] = (uint8_t)alpha1;
+			for (int i = 0; i < 6; i++)
+				out[2 + i] = (uint8_t)(indices >> (i * 8));
+		}
+		// a 4x4 block copied into 64 contiguous bytes, texels past the edge repeat the last row or column
+		void gatherBlock(const uint8_t* texels, uint32_t width, uint32_t height, uint32_t blockX, uint32_t blockY, uint8_t* block) {
+			for (uint32_t y = 0; y < 4; y++) {
+				uint32_t sourceY = std::min(blockY * 4 + y, height - 1);
+				for (uint32_t x = 0; x < 4; x++) {
+					uint32_t sourceX = std::min(blockX * 4 + x, width - 1);
+					std::memcpy(block + (y * 4 + x) * 4, texels + ((size_t)sourceY * width + sourceX) * 4, 4);
+				}
+			}
+		}
+	}
+
+	void encodeBC1(const uint8_t* texels, size_t stride, uint8_t* out) {
+		uint8_t block[64];
+		for (int row = 0; row < 4; row++)
+			std::memcpy(block + row * 16, texels + row * stride, 16);
+		encodeColors(block, out);
+	}
+	void encodeBC3(const uint8_t* texels, size_t stride, uint8_t* out) {
+		uint8_t block[64];
+		for (int row = 0; row < 4; row++)
+			std::memcpy(block + row * 16, texels + row * stride, 16);
+		encodeAlpha(block, out);
+		encodeColors(block, out + 8);
+	}
+	void compressImage(blockFormat format, const uint8_t* texels, uint32_t width, uint32_t height, uint8_t* out, unsigned threads) {
+		if (format == blockFormat::rgba8) {
+			std::memcpy(out, texels, (size_t)width * height * 4);
+			return;
+		}
+		uint32_t blocksX = (width + 3) / 4;
+		uint32_t blocksY = (height + 3) / 4;
+		size_t blockSize = format == blockFormat::bc1 ? 8 : 16;
+		if (!threads)
+			threads = std::max(std::thread::hardware_concurrency(), 1u);
+		threads = std::min(threads, blocksY);
+
+		// every worker takes the next row of blocks until none are left
+		std::atomic<uint32_t> nextRow = 0;
+		auto work = [&]() {
+			uint8_t block[64];
+			for (uint32_t row = nextRow++; row < blocksY; row = nextRow++) {
+				for (uint32_t column = 0; column < blocksX; column++) {
+					gatherBlock(texels, width, height, column, row, block);
+					uint8_t* destination = out + ((size_t)row * blocksX + column) * blockSize;
+					if (format == blockFormat::bc1)
+						encodeBC1(block, 16, destination);
+					else
+						encodeBC3(block, 16, destination);
+				}
+			}
+		};
+		std::vector<std::thread> workers;
+		for (unsigned i = 1; i < threads; i++)
+			workers.emplace_back(work);
+		work();
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+}
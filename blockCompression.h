@@ -0,0 +1,11 @@
+#pragma once
+#include "textureContainer.h"
+
+// S3TC block encoders of the texture cooker (blockCompression.cpp)
+namespace Cooked {
+    // one 4x4 block of RGBA8 texels, stride is the bytes between rows
+    void encodeBC1(const uint8_t* texels, size_t stride, uint8_t* out);
+    void encodeBC3(const uint8_t* texels, size_t stride, uint8_t* out);
+    // every block of an RGBA8 image, split by rows of blocks over threads (0 is one per hardware thread)
+    void compressImage(blockFormat format, const uint8_t* texels, uint32_t width, uint32_t height, uint8_t* out, unsigned threads = 0);
+}
@@ -0,0 +1,127 @@
+#include "blockCompression.h"
+#include <stb/stb_image.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// texture cooker: PNG in, cooked container (textureContainer.h) with the whole mip chain out
+//    TextureCooker input.png [output.etex] [--format rgba8|bc1|bc3] [--threads N]
+// without --format, textures with any translucent texel become BC3 and the rest BC1
+
+namespace {
+	// 2x2 box filter, odd sizes repeat their last row or column
+	std::vector<uint8_t> halve(const std::vector<uint8_t>& texels, uint32_t width, uint32_t height) {
+		uint32_t halfWidth = std::max(width / 2, 1u);
+		uint32_t halfHeight = std::max(height / 2, 1u);
+		std::vector<uint8_t> half((size_t)halfWidth * halfHeight * 4);
+		for (uint32_t y = 0; y < halfHeight; y++) {
+			uint32_t y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+			for (uint32_t x = 0; x < halfWidth; x++) {
+				uint32_t x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+				for (int channel = 0; channel < 4; channel++) {
+					int sum = texels[((size_t)y0 * width + x0) * 4 + channel] + texels[((size_t)y0 * width + x1) * 4 + channel] +
+						texels[((size_t)y1 * width + x0) * 4 + channel] + texels[((size_t)y1 * width + x1) * 4 + channel];
+					half[((size_t)y * halfWidth + x) * 4 + channel] = (uint8_t)((sum + 2) / 4);
+				}
+			}
+		}
+		return half;
+	}
+	size_t align16(size_t offset) {
+		return (offset + 15) & ~(size_t)15;
+	}
+}
+
+int main(int argc, char** argv) {
+	std::string input, output, formatName;
+	unsigned threads = 0;
+	for (int i = 1; i < argc; i++) {
+		std::string argument = argv[i];
+		if (argument == "--format" && i + 1 < argc)
+			formatName = argv[++i];
+		else if (argument == "--threads" && i + 1 < argc)
+			threads = (unsigned)std::stoul(argv[++i]);
+		else if (input.empty())
+			input = argument;
+		else
+			output = argument;
+	}
+	if (input.empty()) {
+		std::cerr << "usage: TextureCooker input.png [output.etex] [--format rgba8|bc1|bc3] [--threads N]" << std::endl;
+		return 1;
+	}
+	if (output.empty())
+		output = input.substr(0, input.find_last_of('.')) + ".etex";
+
+	auto start = std::chrono::steady_clock::now();
+	int width, height, channels;
+	unsigned char* raw = stbi_load(input.c_str(), &width, &height, &channels, 4);
+	if (!raw) {
+		std::cerr << "Failed to load " << input << ": " << stbi_failure_reason() << std::endl;
+		return 1;
+	}
+	std::vector<uint8_t> texels(raw, raw + (size_t)width * height * 4);
+	stbi_image_free(raw);
+
+	Cooked::blockFormat format = Cooked::blockFormat::bc1;
+	if (formatName == "rgba8")
+		format = Cooked::blockFormat::rgba8;
+	else if (formatName == "bc3")
+		format = Cooked::blockFormat::bc3;
+	else if (formatName.empty()) {
+		for (size_t i = 3; i < texels.size(); i += 4) {
+			if (texels[i] != 255) {
+				format = Cooked::blockFormat::bc3;
+				break;
+			}
+		}
+	}
+	else if (formatName != "bc1") {
+		std::cerr << "Unknown format " << formatName << std::endl;
+		return 1;
+	}
+
+	Cooked::header header = { Cooked::magic, Cooked::version, format, (uint32_t)width, (uint32_t)height, Cooked::levelCount(width, height) };
+	std::vector<Cooked::level> levels(header.levels);
+	std::vector<std::vector<uint8_t>> blocks(header.levels);
+	size_t offset = align16(sizeof(Cooked::header) + sizeof(Cooked::level) * header.levels);
+	uint32_t levelWidth = width, levelHeight = height;
+	for (uint32_t level = 0; level < header.levels; level++) {
+		levels[level] = { offset, Cooked::levelSize(format, levelWidth, levelHeight), levelWidth, levelHeight };
+		blocks[level].resize(levels[level].size);
+		Cooked::compressImage(format, texels.data(), levelWidth, levelHeight, blocks[level].data(), threads);
+		offset = align16(offset + levels[level].size);
+		if (level + 1 < header.levels) {
+			texels = halve(texels, levelWidth, levelHeight);
+			levelWidth = std::max(levelWidth / 2, 1u);
+			levelHeight = std::max(levelHeight / 2, 1u);
+		}
+	}
+
+	std::ofstream file(output, std::ios::binary);
+	if (!file) {
+		std::cerr << "Failed to open " << output << std::endl;
+		return 1;
+	}
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)levels.data(), sizeof(Cooked::level) * levels.size());
+	size_t written = sizeof(header) + sizeof(Cooked::level) * levels.size();
+	const char padding[16] = {};
+	for (uint32_t level = 0; level < header.levels; level++) {
+		file.write(padding, levels[level].offset - written);
+		file.write((const char*)blocks[level].data(), blocks[level].size());
+		written = levels[level].offset + levels[level].size;
+	}
+	// the file size stays a multiple of 16 as well
+	file.write(padding, offset - written);
+
+	double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	const char* formatNames[] = { "RGBA8", "BC1", "BC3" };
+	std::cout << input << " -> " << output << ": " << width << "x" << height << ", " << header.levels << " levels, "
+		<< formatNames[(int)format] << ", " << offset << " bytes (" << (double)width * height * 4 * 4 / 3 / offset
+		<< "x smaller than RGBA8 with mipmaps), " << milliseconds << " ms" << std::endl;
+	return 0;
+}
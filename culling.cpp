@@ -0,0 +1,95 @@
+#include "framework.h"
+#include "Include.h"
+
+// widest instruction set the compiler was told it may use, /arch:AVX or -mavx for 8 spheres at a time
+#if defined(__AVX__)
+#include <immintrin.h>
+#define CULL_AVX
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define CULL_SSE
+#endif
+
+namespace Element {
+	// sphereList --
+	void sphereList::clear() {
+		x.clear();
+		y.clear();
+		z.clear();
+		radius.clear();
+	}
+	void sphereList::push_back(const glm::vec4& sphere) {
+		x.push_back(sphere.x);
+		y.push_back(sphere.y);
+		z.push_back(sphere.z);
+		radius.push_back(sphere.w);
+	}
+
+	void cullSpheres(const sphereList& spheres, const std::array<glm::vec4, 6>& planes, std::vector<uint8_t>& visible) {
+		size_t count = spheres.size();
+		visible.resize(count);
+		size_t i = 0;
+
+		// a sphere is outside once it is further than its radius behind any plane
+#if defined(CULL_AVX)
+		__m256 nx[6], ny[6], nz[6], d[6];
+		for (int p = 0; p < 6; p++) {
+			nx[p] = _mm256_set1_ps(planes[p].x);
+			ny[p] = _mm256_set1_ps(planes[p].y);
+			nz[p] = _mm256_set1_ps(planes[p].z);
+			d[p] = _mm256_set1_ps(planes[p].w);
+		}
+		__m256 zero = _mm256_setzero_ps();
+		for (; i + 8 <= count; i += 8) {
+			__m256 x = _mm256_loadu_ps(spheres.x.data() + i);
+			__m256 y = _mm256_loadu_ps(spheres.y.data() + i);
+			__m256 z = _mm256_loadu_ps(spheres.z.data() + i);
+			__m256 r = _mm256_loadu_ps(spheres.radius.data() + i);
+			__m256 inside = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);
+			for (int p = 0; p < 6; p++) {
+				__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx[p], x), _mm256_mul_ps(ny[p], y)),
+					_mm256_add_ps(_mm256_mul_ps(nz[p], z), _mm256_add_ps(d[p], r)));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, zero, _CMP_GE_OQ));
+			}
+			int mask = _mm256_movemask_ps(inside);
+			for (int k = 0; k < 8; k++)
+				visible[i + k] = (mask >> k) & 1;
+		}
+#elif defined(CULL_SSE)
+		__m128 nx[6], ny[6], nz[6], d[6];
+		for (int p = 0; p < 6; p++) {
+			nx[p] = _mm_set1_ps(planes[p].x);
+			ny[p] = _mm_set1_ps(planes[p].y);
+			nz[p] = _mm_set1_ps(planes[p].z);
+			d[p] = _mm_set1_ps(planes[p].w);
+		}
+		__m128 zero = _mm_setzero_ps();
+		for (; i + 4 <= count; i += 4) {
+			__m128 x = _mm_loadu_ps(spheres.x.data() + i);
+			__m128 y = _mm_loadu_ps(spheres.y.data() + i);
+			__m128 z = _mm_loadu_ps(spheres.z.data() + i);
+			__m128 r = _mm_loadu_ps(spheres.radius.data() + i);
+			__m128 inside = _mm_cmpeq_ps(zero, zero);
+			for (int p = 0; p < 6; p++) {
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx[p], x), _mm_mul_ps(ny[p], y)),
+					_mm_add_ps(_mm_mul_ps(nz[p], z), _mm_add_ps(d[p], r)));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, zero));
+			}
+			int mask = _mm_movemask_ps(inside);
+			for (int k = 0; k < 4; k++)
+				visible[i + k] = (mask >> k) & 1;
+		}
+#endif
+		// whatever doesn't fill a whole register
+		for (; i < count; i++) {
+			bool inside = true;
+			for (const glm::vec4& plane : planes) {
+				if (plane.x * spheres.x[i] + plane.y * spheres.y[i] + plane.z * spheres.z[i] + plane.w + spheres.radius[i] < 0) {
+					inside = false;
+					break;
+				}
+			}
+			visible[i] = inside;
+		}
+	}
+}
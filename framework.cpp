@@ -1,12 +1,87 @@
 #include "framework.h"
 #include "Include.h"
 #include "attributes.h"
+#include "textureContainer.h"
+
+#include <filesystem>
+
+// GL_EXT_texture_compression_s3tc, the formats of cooked BC1 and BC3 textures
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// GL_ARB_indirect_parameters, not part of the 4.5 core loader
+#ifndef GL_PARAMETER_BUFFER_ARB
+#define GL_PARAMETER_BUFFER_ARB 0x80EE
+#endif
+typedef void (GLAD_API_PTR* PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTARBPROC)(GLenum mode, GLenum type, const void* indirect, GLintptr drawcount, GLsizei maxdrawcount, GLsizei stride);
+
+// GL_KHR_parallel_shader_compile
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+typedef void (GLAD_API_PTR* PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+namespace {
+	PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTARBPROC multiDrawElementsIndirectCount() {
+		static PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTARBPROC function = glfwExtensionSupported("GL_ARB_indirect_parameters") ?
+			(PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTARBPROC)glfwGetProcAddress("glMultiDrawElementsIndirectCountARB") : nullptr;
+		return function;
+	}
+	// true when GL_COMPLETION_STATUS_KHR can be polled, the driver is told to use as many compiler threads as it likes
+	bool parallelShaderCompile() {
+		static bool supported = []() {
+			if (!glfwExtensionSupported("GL_KHR_parallel_shader_compile"))
+				return false;
+			auto maxThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+			if (maxThreads)
+				maxThreads(0xFFFFFFFF);
+			return true;
+		}();
+		return supported;
+	}
+	// types glUniform1i can set: int and bool uniforms, and the texture unit of a sampler or image
+	bool intUniform(GLenum type) {
+		switch (type) {
+		case GL_INT: case GL_BOOL:
+		case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE: case GL_SAMPLER_1D_SHADOW:
+		case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_1D_ARRAY: case GL_SAMPLER_2D_ARRAY: case GL_SAMPLER_1D_ARRAY_SHADOW:
+		case GL_SAMPLER_2D_ARRAY_SHADOW: case GL_SAMPLER_2D_MULTISAMPLE: case GL_SAMPLER_2D_MULTISAMPLE_ARRAY:
+		case GL_SAMPLER_CUBE_SHADOW: case GL_SAMPLER_BUFFER: case GL_SAMPLER_2D_RECT: case GL_SAMPLER_2D_RECT_SHADOW:
+		case GL_SAMPLER_CUBE_MAP_ARRAY: case GL_SAMPLER_CUBE_MAP_ARRAY_SHADOW:
+		case GL_INT_SAMPLER_1D: case GL_INT_SAMPLER_2D: case GL_INT_SAMPLER_3D: case GL_INT_SAMPLER_CUBE:
+		case GL_INT_SAMPLER_1D_ARRAY: case GL_INT_SAMPLER_2D_ARRAY: case GL_INT_SAMPLER_2D_MULTISAMPLE:
+		case GL_INT_SAMPLER_2D_MULTISAMPLE_ARRAY: case GL_INT_SAMPLER_BUFFER: case GL_INT_SAMPLER_2D_RECT:
+		case GL_INT_SAMPLER_CUBE_MAP_ARRAY:
+		case GL_UNSIGNED_INT_SAMPLER_1D: case GL_UNSIGNED_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_3D:
+		case GL_UNSIGNED_INT_SAMPLER_CUBE: case GL_UNSIGNED_INT_SAMPLER_1D_ARRAY: case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY:
+		case GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE: case GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE_ARRAY:
+		case GL_UNSIGNED_INT_SAMPLER_BUFFER: case GL_UNSIGNED_INT_SAMPLER_2D_RECT: case GL_UNSIGNED_INT_SAMPLER_CUBE_MAP_ARRAY:
+		case GL_IMAGE_1D: case GL_IMAGE_2D: case GL_IMAGE_3D: case GL_IMAGE_2D_RECT: case GL_IMAGE_CUBE: case GL_IMAGE_BUFFER:
+		case GL_IMAGE_1D_ARRAY: case GL_IMAGE_2D_ARRAY: case GL_IMAGE_CUBE_MAP_ARRAY: case GL_IMAGE_2D_MULTISAMPLE:
+		case GL_IMAGE_2D_MULTISAMPLE_ARRAY:
+		case GL_INT_IMAGE_1D: case GL_INT_IMAGE_2D: case GL_INT_IMAGE_3D: case GL_INT_IMAGE_2D_RECT: case GL_INT_IMAGE_CUBE:
+		case GL_INT_IMAGE_BUFFER: case GL_INT_IMAGE_1D_ARRAY: case GL_INT_IMAGE_2D_ARRAY: case GL_INT_IMAGE_CUBE_MAP_ARRAY:
+		case GL_INT_IMAGE_2D_MULTISAMPLE: case GL_INT_IMAGE_2D_MULTISAMPLE_ARRAY:
+		case GL_UNSIGNED_INT_IMAGE_1D: case GL_UNSIGNED_INT_IMAGE_2D: case GL_UNSIGNED_INT_IMAGE_3D:
+		case GL_UNSIGNED_INT_IMAGE_2D_RECT: case GL_UNSIGNED_INT_IMAGE_CUBE: case GL_UNSIGNED_INT_IMAGE_BUFFER:
+		case GL_UNSIGNED_INT_IMAGE_1D_ARRAY: case GL_UNSIGNED_INT_IMAGE_2D_ARRAY: case GL_UNSIGNED_INT_IMAGE_CUBE_MAP_ARRAY:
+		case GL_UNSIGNED_INT_IMAGE_2D_MULTISAMPLE: case GL_UNSIGNED_INT_IMAGE_2D_MULTISAMPLE_ARRAY:
+			return true;
+		default:
+			return false;
+		}
+	}
+}
 
 namespace GL {
 	// buffer --
 	template<typename T>
 	buffer<T>::buffer()
-		: dataType([]() -> GLenum {
+		: ID(0), dataType([]() -> GLenum {
 		if      constexpr (std::is_same_v<T, float> || std::is_same_v<T, GLfloat>)   return GL_FLOAT;
 		else if constexpr (std::is_same_v<T, double> || std::is_same_v<T, GLdouble>)  return GL_DOUBLE;
 		else if constexpr (std::is_same_v<T, int> || std::is_same_v<T, GLint>)     return GL_INT;
@@ -16,12 +91,75 @@ namespace GL {
 		else if constexpr (std::is_same_v<T, char> || std::is_same_v<T, GLbyte>)    return GL_BYTE;
 		else if constexpr (std::is_same_v<T, unsigned char> || std::is_same_v<T, GLubyte>)   return GL_UNSIGNED_BYTE;
 		else if constexpr (std::is_same_v<T, bool> || std::is_same_v<T, GLboolean>) return GL_BOOL;
+		else if constexpr (std::is_class_v<T> && std::is_trivially_copyable_v<T>) return GL_NONE;
 		else static_assert(!sizeof(T), "Unsupported type for buffer");
 			}()) {}
 	template<typename T>
 	buffer<T>::~buffer() {
+		for (GLsync fence : fences) {
+			if (fence)
+				glDeleteSync(fence);
+		}
+		if (mapped) {
+			glBindBuffer(type, ID);
+			glUnmapBuffer(type);
+			glBindBuffer(type, 0);
+		}
 		glDeleteBuffers(1, &ID);
 	}
+	template<typename T>
+	void buffer<T>::stream(size_t count, int frames) {
+		for (GLsync fence : fences) {
+			if (fence)
+				glDeleteSync(fence);
+		}
+		// storage from glBufferStorage is immutable, so start from a fresh buffer
+		glDeleteBuffers(1, &ID);
+		glGenBuffers(1, &ID);
+
+		partitionSize = count;
+		partitions = frames;
+		partition = 0;
+		fences.assign(frames, nullptr);
+		size = count * frames * sizeof(T);
+
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBindBuffer(type, ID);
+		glBufferStorage(type, size, nullptr, flags);
+		mapped = static_cast<T*>(glMapBufferRange(type, 0, size, flags));
+		glBindBuffer(type, 0);
+		if (!mapped)
+			std::cerr << "Failed to map streaming buffer!" << std::endl;
+	}
+	template<typename T>
+	T* buffer<T>::beginFrame() {
+		partition = (partition + 1) % partitions;
+		GLsync& fence = fences[partition];
+		if (fence) {
+			// only blocks when the CPU is more than partitions frames ahead
+			GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+			while (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED && result != GL_WAIT_FAILED)
+				result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+			glDeleteSync(fence);
+			fence = nullptr;
+		}
+		return mapped + partitionOffset();
+	}
+	template<typename T>
+	void buffer<T>::endFrame() {
+		if (fences[partition])
+			glDeleteSync(fences[partition]);
+		fences[partition] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	template<typename T>
+	size_t buffer<T>::partitionOffset() {
+		return partition * partitionSize;
+	}
+	template class buffer<GLfloat>;
+	template class buffer<GLuint>;
+	template class buffer<Element::vertex>;
+	template class buffer<Element::compactVertex>;
+	template class buffer<GLubyte>;
 	// buffers --
 	namespace Buffer {
 		// VBO --
@@ -45,11 +183,16 @@ namespace GL {
 			glBindBuffer(this->type, 0);
 		}
 		template<typename T>
-		void VBO<T>::loadData() {
+		size_t VBO<T>::loadData() {
+			// streamed storage is immutable, glBufferData / glBufferSubData on it are GL_INVALID_OPERATION
+			if (this->mapped) {
+				std::cerr << "Can't load data into a streaming VBO, write its mapped partition instead" << std::endl;
+				return 0;
+			}
 			bind();
 			if (this->data.empty()) {
 				unbind();
-				return;
+				return 0;
 			}
 			size_t dataBytes = this->data.size() * sizeof(T);
 			if (dataBytes != this->size) {
@@ -60,7 +203,26 @@ namespace GL {
 				glBufferSubData(this->type, 0, this->size, this->data.data());
 			}
 			unbind();
+			return dataBytes;
 		}
+		template<typename T>
+		size_t VBO<T>::loadRange(size_t first, size_t count) {
+			if (this->mapped)
+				return loadData();
+			// the GPU copy has to be the same size as data, otherwise reupload it all
+			if (this->data.size() * sizeof(T) != this->size)
+				return loadData();
+			if (count == 0)
+				return 0;
+			bind();
+			glBufferSubData(this->type, first * sizeof(T), count * sizeof(T), this->data.data() + first);
+			unbind();
+			return count * sizeof(T);
+		}
+		template class VBO<GLfloat>;
+		template class VBO<GLuint>;
+		template class VBO<Element::vertex>;
+		template class VBO<Element::compactVertex>;
 
 		// EBO --
 		EBO::EBO(GLenum usage) {
@@ -72,10 +234,10 @@ namespace GL {
 			glBindBuffer(this->type, this->ID);
 			glBufferData(this->type, 0, nullptr, this->usage);
 		}
-		void EBO::loadData() {
+		size_t EBO::loadData() {
 			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ID);
 			if (this->data.empty()) {
-				return;
+				return 0;
 			}
 			size_t dataBytes = this->data.size() * sizeof(GLuint);
 			if (dataBytes != this->size) {
@@ -85,12 +247,178 @@ namespace GL {
 			else {
 				glBufferSubData(this->type, 0, this->size, this->data.data());
 			}
+			return dataBytes;
+		}
+		size_t EBO::loadRange(size_t first, size_t count) {
+			if (this->data.size() * sizeof(GLuint) != this->size)
+				return loadData();
+			if (count == 0)
+				return 0;
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ID);
+			glBufferSubData(this->type, first * sizeof(GLuint), count * sizeof(GLuint), this->data.data() + first);
+			return count * sizeof(GLuint);
 		}
 		void EBO::draw() {
 			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ID);
 			glDrawElements(GL_TRIANGLES, data.size(), GL_UNSIGNED_INT, 0);
 		}
 
+		// DIB --
+		template<typename T>
+		DIB<T>::DIB(GLenum usage) {
+			this->type = GL_DRAW_INDIRECT_BUFFER;
+			this->usage = usage;
+			this->size = 0;
+
+			glGenBuffers(1, &this->ID);
+		}
+		template<typename T>
+		void DIB<T>::bind() {
+			glBindBuffer(this->type, this->ID);
+		}
+		template<typename T>
+		void DIB<T>::unbind() {
+			glBindBuffer(this->type, 0);
+		}
+		template<typename T>
+		size_t DIB<T>::loadData() {
+			if (this->data.empty())
+				return 0;
+			bind();
+			size_t dataBytes = this->data.size() * sizeof(T);
+			if (dataBytes != this->size) {
+				this->size = dataBytes;
+				glBufferData(this->type, this->size, this->data.data(), this->usage);
+			}
+			else {
+				glBufferSubData(this->type, 0, this->size, this->data.data());
+			}
+			unbind();
+			return dataBytes;
+		}
+		template class DIB<DrawElementsIndirectCommand>;
+
+		// UBO --
+		template<typename T>
+		UBO<T>::UBO(GLenum usage) {
+			this->type = GL_UNIFORM_BUFFER;
+			this->usage = usage;
+			this->size = 0;
+
+			glGenBuffers(1, &this->ID);
+		}
+		template<typename T>
+		void UBO<T>::bind() {
+			glBindBuffer(this->type, this->ID);
+		}
+		template<typename T>
+		void UBO<T>::unbind() {
+			glBindBuffer(this->type, 0);
+		}
+		template<typename T>
+		void UBO<T>::bindBase(GLuint index) {
+			glBindBufferBase(this->type, index, this->ID);
+		}
+		template<typename T>
+		size_t UBO<T>::loadData() {
+			if (this->data.empty())
+				return 0;
+			bind();
+			size_t dataBytes = this->data.size() * sizeof(T);
+			if (dataBytes != this->size) {
+				this->size = dataBytes;
+				glBufferData(this->type, this->size, this->data.data(), this->usage);
+			}
+			else {
+				glBufferSubData(this->type, 0, this->size, this->data.data());
+			}
+			unbind();
+			return dataBytes;
+		}
+		template class UBO<Element::cameraBlock>;
+
+		// SSBO --
+		template<typename T>
+		SSBO<T>::SSBO(GLenum usage) {
+			this->type = GL_SHADER_STORAGE_BUFFER;
+			this->usage = usage;
+			this->size = 0;
+
+			glGenBuffers(1, &this->ID);
+		}
+		template<typename T>
+		void SSBO<T>::bind() {
+			glBindBuffer(this->type, this->ID);
+		}
+		template<typename T>
+		void SSBO<T>::unbind() {
+			glBindBuffer(this->type, 0);
+		}
+		template<typename T>
+		void SSBO<T>::bindBase(GLuint index) {
+			glBindBufferBase(this->type, index, this->ID);
+		}
+		template<typename T>
+		size_t SSBO<T>::loadData() {
+			if (this->data.empty())
+				return 0;
+			bind();
+			size_t dataBytes = this->data.size() * sizeof(T);
+			if (dataBytes != this->size) {
+				this->size = dataBytes;
+				glBufferData(this->type, this->size, this->data.data(), this->usage);
+			}
+			else {
+				glBufferSubData(this->type, 0, this->size, this->data.data());
+			}
+			unbind();
+			return dataBytes;
+		}
+		template class SSBO<glm::vec4>;
+		template class SSBO<DrawElementsIndirectCommand>;
+		template class SSBO<Element::cullLevel>;
+		template class SSBO<glm::uvec2>;
+		template class SSBO<GLuint>;
+
+		// ACBO --
+		template<typename T>
+		ACBO<T>::ACBO(GLenum usage) {
+			this->type = GL_ATOMIC_COUNTER_BUFFER;
+			this->usage = usage;
+			this->size = 0;
+
+			glGenBuffers(1, &this->ID);
+		}
+		template<typename T>
+		void ACBO<T>::bind() {
+			glBindBuffer(this->type, this->ID);
+		}
+		template<typename T>
+		void ACBO<T>::unbind() {
+			glBindBuffer(this->type, 0);
+		}
+		template<typename T>
+		void ACBO<T>::bindBase(GLuint index) {
+			glBindBufferBase(this->type, index, this->ID);
+		}
+		template<typename T>
+		size_t ACBO<T>::loadData() {
+			if (this->data.empty())
+				return 0;
+			bind();
+			size_t dataBytes = this->data.size() * sizeof(T);
+			if (dataBytes != this->size) {
+				this->size = dataBytes;
+				glBufferData(this->type, this->size, this->data.data(), this->usage);
+			}
+			else {
+				glBufferSubData(this->type, 0, this->size, this->data.data());
+			}
+			unbind();
+			return dataBytes;
+		}
+		template class ACBO<GLuint>;
+
 		// TFB --
 		template<typename T>
 		TFB<T>::TFB(GLenum usage) {
@@ -153,32 +481,14 @@ namespace GL {
 	void VAO::unbind() {
 		glBindVertexArray(0);
 	}
-	template<typename T>
-	void VAO::configure(buffer<T>* buffer, GLuint index, GLint size, int dataSize, int offSet) {
-		bind();
-		glBindBuffer(buffer->type, buffer->ID);
-		glVertexAttribPointer(index, size, buffer->dataType, GL_FALSE, dataSize * sizeof(T), (void*)(offSet * sizeof(T)));
-		glEnableVertexAttribArray(index);
-		unbind();
+	void VAO::attribute(const vertexAttribute& attribute, GLsizei stride, GLuint divisor) {
+		if (attribute.format == attribFormat::integer)
+			glVertexAttribIPointer(attribute.index, attribute.size, attribute.type, stride, (void*)attribute.offset);
+		else
+			glVertexAttribPointer(attribute.index, attribute.size, attribute.type, attribute.format == attribFormat::normalized, stride, (void*)attribute.offset);
+		glVertexAttribDivisor(attribute.index, divisor);
+		glEnableVertexAttribArray(attribute.index);
 	}
-	template void VAO::configure<float>(buffer<float>*, GLuint, GLint, int, int);
-	template void VAO::configure<GLfloat>(buffer<GLfloat>*, GLuint, GLint, int, int);
-	template void VAO::configure<double>(buffer<double>*, GLuint, GLint, int, int);
-	template void VAO::configure<GLdouble>(buffer<GLdouble>*, GLuint, GLint, int, int);
-	template void VAO::configure<int>(buffer<int>*, GLuint, GLint, int, int);
-	template void VAO::configure<GLint>(buffer<GLint>*, GLuint, GLint, int, int);
-	template void VAO::configure<unsigned int>(buffer<unsigned int>*, GLuint, GLint, int, int);
-	template void VAO::configure<GLuint>(buffer<GLuint>*, GLuint, GLint, int, int);
-	template void VAO::configure<short>(buffer<short>*, GLuint, GLint, int, int);
-	template void VAO::configure<GLshort>(buffer<GLshort>*, GLuint, GLint, int, int);
-	template void VAO::configure<unsigned short>(buffer<unsigned short>*, GLuint, GLint, int, int);
-	template void VAO::configure<GLushort>(buffer<GLushort>*, GLuint, GLint, int, int);
-	template void VAO::configure<char>(buffer<char>*, GLuint, GLint, int, int);
-	template void VAO::configure<GLbyte>(buffer<GLbyte>*, GLuint, GLint, int, int);
-	template void VAO::configure<unsigned char>(buffer<unsigned char>*, GLuint, GLint, int, int);
-	template void VAO::configure<GLubyte>(buffer<GLubyte>*, GLuint, GLint, int, int);
-	template void VAO::configure<bool>(buffer<bool>*, GLuint, GLint, int, int);
-	template void VAO::configure<GLboolean>(buffer<GLboolean>*, GLuint, GLint, int, int);
 
 	// shaderProgram --
 	shaderProgram::shaderProgram() {
@@ -187,41 +497,472 @@ namespace GL {
 	shaderProgram::~shaderProgram() {
 		glDeleteProgram(ID);
 	}
+	std::string shaderProgram::binaryCache;
+	size_t shaderProgram::binaryHits = 0;
+	size_t shaderProgram::binaryMisses = 0;
 	void shaderProgram::addShader(GLenum shaderType, const std::string& shaderFilePath) {
 		std::ifstream file(shaderFilePath);
+		if (!file)
+			std::cerr << "Failed to open shader " << shaderFilePath << std::endl;
 		std::stringstream buffer;
 		buffer << file.rdbuf();
-		std::string shaderData = buffer.str();
-
-		GLuint shader = glCreateShader(shaderType);
-		const char* shaderSource = shaderData.c_str();
-
-		glShaderSource(shader, 1, &shaderSource, nullptr);
-		glCompileShader(shader);
-
+		stages.push_back({ shaderType, shaderFilePath, buffer.str() });
+	}
+	void shaderProgram::compile() {
+		build();
+		// without polling, every finish() waits for the driver
+		while (status == programStatus::building)
+			finish();
+	}
+	void shaderProgram::build() {
+		for (stage& stage : stages)
+			preprocess(stage);
+		cachePath = binaryCache.empty() ? std::string() : binaryPath();
+		fromBinary = !cachePath.empty() && loadBinary(cachePath);
+		if (!fromBinary)
+			submitStages();
+		status = programStatus::building;
+	}
+	bool shaderProgram::ready() {
+		if (status != programStatus::building)
+			return status == programStatus::ready;
+		if (parallelShaderCompile()) {
+			GLint complete = GL_FALSE;
+			glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &complete);
+			if (!complete)
+				return false;
+		}
+		finish();
+		return status == programStatus::ready;
+	}
+	void shaderProgram::submitStages() {
+		// no status is read until the link is done, so the driver can work on every stage at once
+		for (stage& stage : stages) {
+			GLuint shader = glCreateShader(stage.type);
+			const char* shaderSource = stage.expanded.c_str();
+			glShaderSource(shader, 1, &shaderSource, nullptr);
+			glCompileShader(shader);
+			glAttachShader(ID, shader);
+			shaderIDs.push_back(shader);
+		}
+		if (!cachePath.empty())
+			glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(ID);
+	}
+	void shaderProgram::finish() {
 		GLint success;
-		glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+		glGetProgramiv(ID, GL_LINK_STATUS, &success);
+		if (fromBinary) {
+			if (success) {
+				binaryHits++;
+				stages.clear();
+				status = programStatus::ready;
+				reflect();
+				return;
+			}
+			// a binary the driver no longer takes leaves the program unlinked, it's compiled and the file replaced
+			fromBinary = false;
+			submitStages();
+			return;
+		}
+		if (!cachePath.empty())
+			binaryMisses++;
+
+		for (size_t i = 0; i < shaderIDs.size(); i++) {
+			GLint compiled;
+			glGetShaderiv(shaderIDs[i], GL_COMPILE_STATUS, &compiled);
+			if (!compiled) {
+				char infoLog[1024];
+				glGetShaderInfoLog(shaderIDs[i], 1024, nullptr, infoLog);
+				// the log numbers lines as file:line or file(line), file being the index into files
+				std::cerr << "ERROR::SHADER_COMPILATION_FAILED " << stages[i].path << "\n" << infoLog;
+				for (size_t file = 1; file < stages[i].files.size(); file++)
+					std::cerr << "source " << file << " is " << stages[i].files[file] << "\n";
+				std::cerr << std::endl;
+			}
+			glDetachShader(ID, shaderIDs[i]);
+			glDeleteShader(shaderIDs[i]);
+		}
+		shaderIDs.clear();
+		shaderIDs.shrink_to_fit();
+		stages.clear();
+
 		if (!success) {
 			char infoLog[1024];
-			glGetShaderInfoLog(shader, 1024, nullptr, infoLog);
-			std::cerr << "ERROR::SHADER_COMPILATION_FAILED\n" << infoLog << std::endl;
+			glGetProgramInfoLog(ID, 1024, nullptr, infoLog);
+			std::cerr << "ERROR::PROGRAM_LINKING_FAILED\n" << infoLog << std::endl;
+			status = programStatus::failed;
+			return;
+		}
+		if (!cachePath.empty())
+			saveBinary(cachePath);
+		status = programStatus::ready;
+		reflect();
+	}
+	void shaderProgram::preprocess(stage& stage) {
+		stage.expanded.clear();
+		stage.files.clear();
+		expand(stage.path, stage.source, stage);
+	}
+	void shaderProgram::expand(const std::string& path, const std::string& source, stage& stage) {
+		int file = (int)stage.files.size();
+		stage.files.push_back(path);
+		std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+
+		std::istringstream lines(source);
+		std::string line;
+		int number = 0;
+		while (std::getline(lines, line)) {
+			number++;
+			size_t start = line.find_first_not_of(" \t");
+			if (start != std::string::npos && line.compare(start, 8, "#include") == 0) {
+				size_t open = line.find('"', start);
+				size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+				if (close == std::string::npos) {
+					std::cerr << "Malformed #include in " << path << " line " << number << std::endl;
+					continue;
+				}
+				// every file once per stage, so includes need no guards
+				std::string includePath = directory + line.substr(open + 1, close - open - 1);
+				if (std::find(stage.files.begin(), stage.files.end(), includePath) == stage.files.end()) {
+					std::ifstream include(includePath);
+					if (!include) {
+						std::cerr << "Failed to open shader include " << includePath << " from " << path << std::endl;
+						continue;
+					}
+					std::stringstream buffer;
+					buffer << include.rdbuf();
+					stage.expanded += "#line 1 " + std::to_string(stage.files.size()) + "\n";
+					expand(includePath, buffer.str(), stage);
+					stage.expanded += "#line " + std::to_string(number + 1) + " " + std::to_string(file) + "\n";
+				}
+				continue;
+			}
+			stage.expanded += line;
+			stage.expanded += '\n';
+			// #version has to stay the first line, the defines come right after it
+			if (file == 0 && start != std::string::npos && line.compare(start, 8, "#version") == 0 && !defines.empty()) {
+				for (auto& [name, value] : defines)
+					stage.expanded += "#define " + name + " " + value + "\n";
+				stage.expanded += "#line " + std::to_string(number + 1) + " 0\n";
+			}
+		}
+	}
+	std::string shaderProgram::binaryPath() {
+		// a driver update can change or reject the binaries, so its strings are part of the key
+		uint64_t hash = 14695981039346656037ull;
+		auto add = [&hash](const void* bytes, size_t size) {
+			for (size_t i = 0; i < size; i++) {
+				hash ^= ((const unsigned char*)bytes)[i];
+				hash *= 1099511628211ull;
+			}
+		};
+		for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+			const char* value = (const char*)glGetString(name);
+			if (value)
+				add(value, std::strlen(value) + 1);
+		}
+		for (stage& stage : stages) {
+			add(&stage.type, sizeof(stage.type));
+			add(stage.expanded.data(), stage.expanded.size() + 1);
+		}
+		char name[17];
+		std::snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash);
+		return binaryCache + "/" + name + ".bin";
+	}
+	bool shaderProgram::loadBinary(const std::string& path) {
+		std::ifstream file(path, std::ios::binary);
+		GLenum format;
+		if (!file.read((char*)&format, sizeof(format)))
+			return false;
+		std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		// whether the driver takes it shows in GL_LINK_STATUS once finish() asks
+		glProgramBinary(ID, format, binary.data(), (GLsizei)binary.size());
+		return true;
+	}
+	void shaderProgram::saveBinary(const std::string& path) {
+		GLint length = 0;
+		glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return;
+		std::vector<char> binary(length);
+		GLenum format;
+		glGetProgramBinary(ID, length, &length, &format, binary.data());
+		std::error_code error;
+		std::filesystem::create_directories(binaryCache, error);
+		std::ofstream file(path, std::ios::binary);
+		file.write((const char*)&format, sizeof(format));
+		file.write(binary.data(), length);
+		if (!file)
+			std::cerr << "Failed to write program binary " << path << std::endl;
+	}
+	void shaderProgram::reflect() {
+		uniforms.clear();
+		uniformBlocks.clear();
+
+		GLint count;
+		char name[256];
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+		for (GLint i = 0; i < count; i++) {
+			GLsizei length;
+			GLint size;
+			GLenum type;
+			glGetActiveUniform(ID, i, sizeof(name), &length, &size, &type, name);
+			GLint location = glGetUniformLocation(ID, name);
+			// members of uniform blocks have no location
+			if (location == -1)
+				continue;
+			std::string uniformName(name, length);
+			if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+				uniformName.resize(uniformName.size() - 3);
+			uniforms[uniformName] = { location, type, size };
 		}
 
-		glAttachShader(ID, shader);
-		shaderIDs.push_back(shader);
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+		for (GLint i = 0; i < count; i++) {
+			GLsizei length;
+			glGetActiveUniformBlockName(ID, i, sizeof(name), &length, name);
+			uniformBlocks[std::string(name, length)] = i;
+		}
+		bindBlock("Camera", Element::cameraBlock::binding);
 	}
-	void shaderProgram::compile() {
-		glLinkProgram(ID);
-		size_t size = shaderIDs.size();
-		for (int i = 0; i < size; i++)
-			glDeleteShader(shaderIDs.at(i));
-		shaderIDs.clear();
-		shaderIDs.shrink_to_fit();
+	void shaderProgram::bindBlock(const std::string& name, GLuint binding) {
+		auto block = uniformBlocks.find(name);
+		if (block != uniformBlocks.end())
+			glUniformBlockBinding(ID, block->second, binding);
+	}
+	template<typename T>
+	uniform<T> shaderProgram::getUniform(const std::string& name) {
+		constexpr GLenum expected = []() -> GLenum {
+			if      constexpr (std::is_same_v<T, GLfloat>)   return GL_FLOAT;
+			else if constexpr (std::is_same_v<T, glm::vec2>) return GL_FLOAT_VEC2;
+			else if constexpr (std::is_same_v<T, glm::vec3>) return GL_FLOAT_VEC3;
+			else if constexpr (std::is_same_v<T, glm::vec4>) return GL_FLOAT_VEC4;
+			else if constexpr (std::is_same_v<T, GLint>)     return GL_INT;
+			else if constexpr (std::is_same_v<T, GLuint>)    return GL_UNSIGNED_INT;
+			else if constexpr (std::is_same_v<T, glm::mat4>) return GL_FLOAT_MAT4;
+			else static_assert(!sizeof(T), "Unsupported type for uniform");
+			}();
+
+		uniform<T> handle;
+		handle.program = ID;
+		auto info = uniforms.find(name);
+		if (info == uniforms.end())
+			return handle;
+		// samplers and images are set as ints
+		bool matches = expected == GL_INT ? intUniform(info->second.type) : info->second.type == expected;
+		if (!matches)
+			std::cerr << "Uniform " << name << " is used with the wrong type" << std::endl;
+		handle.location = info->second.location;
+		return handle;
 	}
 	void shaderProgram::useProgram() {
 		glUseProgram(ID);
 	}
 
+	// shaderPermutations --
+	shaderPermutations::shaderPermutations(std::vector<std::string> features) : features(features) {}
+	void shaderPermutations::addShader(GLenum shaderType, const std::string& shaderFilePath) {
+		stageFiles.push_back({ shaderType, shaderFilePath });
+	}
+	shaderProgram* shaderPermutations::get(uint32_t mask) {
+		std::unique_ptr<shaderProgram>& program = programs[mask];
+		if (program)
+			return program.get();
+		program = std::make_unique<shaderProgram>();
+		for (size_t i = 0; i < features.size(); i++)
+			program->defines[features[i]] = mask & (1u << i) ? "1" : "0";
+		for (auto& [type, path] : stageFiles)
+			program->addShader(type, path);
+		program->build();
+		return program.get();
+	}
+
+	// uniform --
+	template<typename T>
+	void uniform<T>::set(const T& value) {
+		set(&value, 1);
+	}
+	template<typename T>
+	void uniform<T>::set(const T* values, GLsizei count) {
+		if (location == -1)
+			return;
+		if      constexpr (std::is_same_v<T, GLfloat>)   glProgramUniform1fv(program, location, count, values);
+		else if constexpr (std::is_same_v<T, glm::vec2>) glProgramUniform2fv(program, location, count, glm::value_ptr(*values));
+		else if constexpr (std::is_same_v<T, glm::vec3>) glProgramUniform3fv(program, location, count, glm::value_ptr(*values));
+		else if constexpr (std::is_same_v<T, glm::vec4>) glProgramUniform4fv(program, location, count, glm::value_ptr(*values));
+		else if constexpr (std::is_same_v<T, GLint>)     glProgramUniform1iv(program, location, count, values);
+		else if constexpr (std::is_same_v<T, GLuint>)    glProgramUniform1uiv(program, location, count, values);
+		else if constexpr (std::is_same_v<T, glm::mat4>) glProgramUniformMatrix4fv(program, location, count, GL_FALSE, glm::value_ptr(*values));
+	}
+	template class uniform<GLfloat>;
+	template class uniform<glm::vec2>;
+	template class uniform<glm::vec3>;
+	template class uniform<glm::vec4>;
+	template class uniform<GLint>;
+	template class uniform<GLuint>;
+	template class uniform<glm::mat4>;
+	template uniform<GLfloat> shaderProgram::getUniform<GLfloat>(const std::string&);
+	template uniform<glm::vec2> shaderProgram::getUniform<glm::vec2>(const std::string&);
+	template uniform<glm::vec3> shaderProgram::getUniform<glm::vec3>(const std::string&);
+	template uniform<glm::vec4> shaderProgram::getUniform<glm::vec4>(const std::string&);
+	template uniform<GLint> shaderProgram::getUniform<GLint>(const std::string&);
+	template uniform<GLuint> shaderProgram::getUniform<GLuint>(const std::string&);
+	template uniform<glm::mat4> shaderProgram::getUniform<glm::mat4>(const std::string&);
+
+	// framebuffer --
+	framebuffer::framebuffer() {
+		glGenFramebuffers(1, &ID);
+	}
+	framebuffer::~framebuffer() {
+		release();
+		glDeleteFramebuffers(1, &ID);
+	}
+	void framebuffer::release() {
+		if (!colors.empty())
+			glDeleteTextures(colors.size(), colors.data());
+		colors.clear();
+		if (depth)
+			glDeleteRenderbuffers(1, &depth);
+		depth = 0;
+	}
+	void framebuffer::create(int width, int height, const std::vector<GLenum>& colorFormats, GLenum depthFormat) {
+		if (width == this->width && height == this->height && colorFormats == this->colorFormats && depthFormat == this->depthFormat)
+			return;
+		release();
+		this->width = width;
+		this->height = height;
+		this->colorFormats = colorFormats;
+		this->depthFormat = depthFormat;
+
+		bind();
+		colors.resize(colorFormats.size());
+		glGenTextures(colors.size(), colors.data());
+		std::vector<GLenum> drawBuffers;
+		for (size_t i = 0; i < colors.size(); i++) {
+			glBindTexture(GL_TEXTURE_2D, colors[i]);
+			glTexStorage2D(GL_TEXTURE_2D, 1, colorFormats[i], width, height);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, colors[i], 0);
+			drawBuffers.push_back(GL_COLOR_ATTACHMENT0 + i);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glDrawBuffers(drawBuffers.size(), drawBuffers.data());
+
+		if (depthFormat != GL_NONE) {
+			glGenRenderbuffers(1, &depth);
+			glBindRenderbuffer(GL_RENDERBUFFER, depth);
+			glRenderbufferStorage(GL_RENDERBUFFER, depthFormat, width, height);
+			glBindRenderbuffer(GL_RENDERBUFFER, 0);
+			GLenum attachment = (depthFormat == GL_DEPTH24_STENCIL8 || depthFormat == GL_DEPTH32F_STENCIL8) ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER, attachment, GL_RENDERBUFFER, depth);
+		}
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cerr << "ERROR::FRAMEBUFFER::INCOMPLETE" << std::endl;
+		unbind();
+	}
+	void framebuffer::bind() {
+		glBindFramebuffer(GL_FRAMEBUFFER, ID);
+	}
+	void framebuffer::unbind() {
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	// query --
+	query::query(GLenum target) : target(target) {
+		glGenQueries(1, &ID);
+	}
+	query::~query() {
+		glDeleteQueries(1, &ID);
+	}
+	void query::begin() {
+		glBeginQuery(target, ID);
+	}
+	void query::end() {
+		glEndQuery(target);
+	}
+	bool query::available() {
+		GLuint available = GL_FALSE;
+		glGetQueryObjectuiv(ID, GL_QUERY_RESULT_AVAILABLE, &available);
+		return available == GL_TRUE;
+	}
+	GLuint64 query::result() {
+		GLuint64 result = 0;
+		glGetQueryObjectui64v(ID, GL_QUERY_RESULT, &result);
+		return result;
+	}
+
+	// textureArray --
+	textureArray::textureArray(int width, int height, GLenum format) : width(width), height(height), format(format) {
+		levels = 1;
+		while ((std::max(width, height) >> levels) > 0)
+			levels++;
+	}
+	textureArray::~textureArray() {
+		if (ID)
+			glDeleteTextures(1, &ID);
+	}
+	void textureArray::reserve(int capacity) {
+		GLuint previous = ID;
+		glGenTextures(1, &ID);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, ID);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, format, width, height, capacity);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		// immutable storage can't grow, the layers so far are copied over on the GPU
+		if (previous) {
+			for (int level = 0; level < levels; level++) {
+				glCopyImageSubData(previous, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+					ID, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+					std::max(width >> level, 1), std::max(height >> level, 1), layers);
+			}
+			glDeleteTextures(1, &previous);
+		}
+		this->capacity = capacity;
+	}
+	int textureArray::addLayer() {
+		if (!freeLayers.empty()) {
+			int layer = freeLayers.back();
+			freeLayers.pop_back();
+			return layer;
+		}
+		if (layers == capacity)
+			reserve(std::max(capacity * 2, 4));
+		return layers++;
+	}
+	void textureArray::releaseLayer(int layer) {
+		freeLayers.push_back(layer);
+	}
+	void textureArray::upload(int layer, const void* pixels, GLenum pixelFormat, GLenum pixelType, int level) {
+		glBindTexture(GL_TEXTURE_2D_ARRAY, ID);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, std::max(width >> level, 1), std::max(height >> level, 1), 1, pixelFormat, pixelType, pixels);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	}
+	void textureArray::uploadCompressed(int layer, int level, const void* blocks, GLsizei size) {
+		glBindTexture(GL_TEXTURE_2D_ARRAY, ID);
+		glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, std::max(width >> level, 1), std::max(height >> level, 1), 1, format, size, blocks);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	}
+	bool textureArray::compressed() const {
+		return format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT || format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	}
+	void textureArray::generateMipmaps() {
+		glBindTexture(GL_TEXTURE_2D_ARRAY, ID);
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	}
+	void textureArray::bind(GLuint unit) {
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, ID);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
 	// window --
 	void window::onResize(int width, int height) {
 		transform.size.x = width;
@@ -339,54 +1080,107 @@ namespace GL {
 }
 
 namespace Element {
-	// mesh --
-	void mesh::triangle(glm::vec3 vertexPos1, glm::vec3 vertexPos2, glm::vec3 vertexPos3, glm::vec4 color) {
-		vertacies.push_back(vertexPos1.x);
-		vertacies.push_back(vertexPos1.y);
-		vertacies.push_back(vertexPos1.z);
-
-		vertacies.push_back(vertexPos2.x);
-		vertacies.push_back(vertexPos2.y);
-		vertacies.push_back(vertexPos2.z);
+	namespace {
+		// collects neighbouring dirty ranges of a buffer so they go up in one call
+		template<typename Buffer>
+		struct rangeUploader {
+			Buffer& buffer;
+			size_t stride;
+			size_t& uploadedBytes;
+			size_t first = 0;
+			size_t end = 0;
+
+			rangeUploader(Buffer& buffer, size_t stride, size_t& uploadedBytes)
+				: buffer(buffer), stride(stride), uploadedBytes(uploadedBytes) {}
+			void add(size_t rangeFirst, size_t rangeEnd) {
+				if (first != end && end != rangeFirst)
+					flush();
+				if (first == end)
+					first = rangeFirst;
+				end = rangeEnd;
+			}
+			void flush() {
+				if (first != end)
+					uploadedBytes += buffer.loadRange(first * stride, (end - first) * stride);
+				first = end = 0;
+			}
+		};
 
-		vertacies.push_back(vertexPos3.x);
-		vertacies.push_back(vertexPos3.y);
-		vertacies.push_back(vertexPos3.z);
+		// meshes without indices are drawn as a triangle soup
+		size_t indexCount(const mesh& mesh) {
+			return mesh.indices.empty() ? mesh.vertacies.size() / 3 : mesh.indices.size();
+		}
+		// a model's vertices and indices hold its whole LOD chain, level after level
+		size_t chainVertices(model& model) {
+			size_t count = 0;
+			for (size_t level = 0; level < model.lodLevels(); level++)
+				count += model.lod(level).vertacies.size() / 3;
+			return count;
+		}
+		size_t chainIndices(model& model) {
+			size_t count = 0;
+			for (size_t level = 0; level < model.lodLevels(); level++)
+				count += indexCount(model.lod(level));
+			return count;
+		}
+		size_t chainRevision(model& model) {
+			// the texture's revision too, its pool ID is written with the vertices
+			size_t revision = model.lodLevels() * 31 + model.texture.revision;
+			for (size_t level = 0; level < model.lodLevels(); level++)
+				revision = revision * 31 + model.lod(level).revision;
+			return revision;
+		}
+		// first index and index count of one level inside the chain
+		std::pair<size_t, size_t> lodIndices(model& model, size_t level) {
+			size_t first = 0;
+			for (size_t i = 0; i < level; i++)
+				first += indexCount(model.lod(i));
+			return { first, indexCount(model.lod(level)) };
+		}
+		void writeIndices(GLuint* out, const mesh& mesh, GLuint offset) {
+			if (mesh.indices.empty()) {
+				std::iota(out, out + mesh.vertacies.size() / 3, offset);
+				return;
+			}
+			for (GLuint index : mesh.indices)
+				*out++ = index + offset;
+		}
+	}
 
-		for (int i = 0; i < 3; i++) {
-			colors.push_back(color.x);
-			colors.push_back(color.y);
-			colors.push_back(color.z);
-			colors.push_back(color.a);
+	// mesh --
+	GLuint mesh::vertex(glm::vec3 position, glm::vec4 color) {
+		revision++;
+		vertacies.push_back(position.x);
+		vertacies.push_back(position.y);
+		vertacies.push_back(position.z);
+
+		colors.push_back(color.x);
+		colors.push_back(color.y);
+		colors.push_back(color.z);
+		colors.push_back(color.a);
+		if (!uvs.empty()) {
+			uvs.push_back(0);
+			uvs.push_back(0);
 		}
+		return vertacies.size() / 3 - 1;
+	}
+	GLuint mesh::vertex(glm::vec3 position, glm::vec4 color, glm::vec2 uv) {
+		GLuint index = vertex(position, color);
+		// vertices added before the first UV get (0, 0)
+		uvs.resize(index * 2);
+		uvs.push_back(uv.x);
+		uvs.push_back(uv.y);
+		return index;
+	}
+	void mesh::triangle(glm::vec3 vertexPos1, glm::vec3 vertexPos2, glm::vec3 vertexPos3, glm::vec4 color) {
+		indices.push_back(vertex(vertexPos1, color));
+		indices.push_back(vertex(vertexPos2, color));
+		indices.push_back(vertex(vertexPos3, color));
 	}
 	void mesh::colorTriangle(glm::vec3 vertexPos1, glm::vec3 vertexPos2, glm::vec3 vertexPos3, glm::vec4 color1, glm::vec4 color2, glm::vec4 color3) {
-		vertacies.push_back(vertexPos1.x);
-		vertacies.push_back(vertexPos1.y);
-		vertacies.push_back(vertexPos1.z);
-
-		vertacies.push_back(vertexPos2.x);
-		vertacies.push_back(vertexPos2.y);
-		vertacies.push_back(vertexPos2.z);
-
-		vertacies.push_back(vertexPos3.x);
-		vertacies.push_back(vertexPos3.y);
-		vertacies.push_back(vertexPos3.z);
-
-		colors.push_back(color1.x);
-		colors.push_back(color1.y);
-		colors.push_back(color1.z);
-		colors.push_back(color1.a);
-
-		colors.push_back(color2.x);
-		colors.push_back(color2.y);
-		colors.push_back(color2.z);
-		colors.push_back(color2.a);
-
-		colors.push_back(color3.x);
-		colors.push_back(color3.y);
-		colors.push_back(color3.z);
-		colors.push_back(color3.a);
+		indices.push_back(vertex(vertexPos1, color1));
+		indices.push_back(vertex(vertexPos2, color2));
+		indices.push_back(vertex(vertexPos3, color3));
 	}
 	void mesh::rectangle(glm::vec3 position, glm::vec4 rotation, glm::vec2 size, glm::vec4 color) {
 		glm::quat rotQuat = glm::quat(glm::radians(rotation.a), rotation.x, rotation.y, rotation.z);
@@ -398,11 +1192,13 @@ namespace Element {
 			glm::vec3(0, size.y, 0),
 			glm::vec3(size.x, size.y, 0)
 		};
+		GLuint ids[4];
 		for (int i = 0; i < 4; ++i) {
-			corners[i] = rotQuat * corners[i] + position;
+			ids[i] = vertex(rotQuat * corners[i] + position, color);
 		}
-		triangle(corners[0], corners[1], corners[2], color);
-		triangle(corners[2], corners[1], corners[3], color);
+		indices.insert(indices.end(), {
+			ids[0], ids[1], ids[2],
+			ids[2], ids[1], ids[3] });
 	}
 	void mesh::circle(glm::vec3 position, glm::vec4 rotation, float radius, int segments, glm::vec4 color) {
 		if (segments < 3) segments = 3;
@@ -411,18 +1207,19 @@ namespace Element {
 		// Create quaternion from rotation
 		glm::quat rotQuat = glm::yawPitchRoll(rotation.y, rotation.x, rotation.z);
 
+		GLuint center = vertex(position, color);
+		GLuint first = center + 1;
 		for (int i = 0; i < segments; ++i) {
-			float angle1 = i * angleStep;
-			float angle2 = (i + 1) * angleStep;
-
-			glm::vec3 point1 = glm::vec3(radius * cos(angle1), radius * sin(angle1), 0);
-			glm::vec3 point2 = glm::vec3(radius * cos(angle2), radius * sin(angle2), 0);
+			float angle = i * angleStep;
+			glm::vec3 point = glm::vec3(radius * cos(angle), radius * sin(angle), 0);
 
 			// Apply rotation and translation
-			point1 = rotQuat * point1 + position;
-			point2 = rotQuat * point2 + position;
-
-			triangle(position, point1, point2, color);
+			vertex(rotQuat * point + position, color);
+		}
+		for (int i = 0; i < segments; ++i) {
+			indices.push_back(center);
+			indices.push_back(first + i);
+			indices.push_back(first + (i + 1) % segments);
 		}
 	}
 	void mesh::cube(glm::vec3 position, glm::vec4 rotation, glm::vec3 size, glm::vec4 color) {
@@ -439,74 +1236,54 @@ namespace Element {
 			glm::vec3(0, size.y, size.z),
 			glm::vec3(size.x, size.y, size.z)
 		};
+		GLuint c[8];
 		for (int i = 0; i < 8; ++i) {
-			corners[i] = rotQuat * corners[i] + position;
+			c[i] = vertex(rotQuat * corners[i] + position, color);
 		}
-		triangle(corners[0], corners[1], corners[2], color);
-		triangle(corners[2], corners[1], corners[3], color);
+		indices.insert(indices.end(), {
+			c[0], c[1], c[2],
+			c[2], c[1], c[3],
 
-		triangle(corners[2], corners[3], corners[4], color);
-		triangle(corners[4], corners[3], corners[5], color);
+			c[2], c[3], c[4],
+			c[4], c[3], c[5],
 
-		triangle(corners[4], corners[5], corners[6], color);
-		triangle(corners[6], corners[5], corners[7], color);
+			c[4], c[5], c[6],
+			c[6], c[5], c[7],
 
-		triangle(corners[6], corners[7], corners[0], color);
-		triangle(corners[0], corners[7], corners[1], color);
+			c[6], c[7], c[0],
+			c[0], c[7], c[1],
 
-		triangle(corners[0], corners[1], corners[5], color);
-		triangle(corners[0], corners[4], corners[5], color);
+			c[0], c[1], c[5],
+			c[0], c[4], c[5],
 
-		triangle(corners[2], corners[3], corners[6], color);
-		triangle(corners[4], corners[6], corners[7], color);
+			c[2], c[3], c[6],
+			c[4], c[6], c[7] });
 	}
 	void mesh::sphere(glm::vec3 position, float radius, float segments, glm::vec3 size, glm::vec4 color) {
 		int seg = (int)segments;
+		// one vertex per grid point, the quads between rows y and y + 1 share them
+		GLuint first = vertacies.size() / 3;
+		for (int y = 0; y <= seg + 1; y++) {
+			float theta = (float)y / seg * glm::pi<float>();
+			for (int x = 0; x <= seg + 1; x++) {
+				float phi = (float)x / seg * glm::two_pi<float>();
+				vertex(glm::vec3(
+					radius * sin(theta) * cos(phi),
+					radius * cos(theta),
+					radius * sin(theta) * sin(phi)) + position, color, glm::vec2((float)x / seg, (float)y / seg));
+			}
+		}
+		GLuint row = seg + 2;
 		for (int y = 0; y <= seg; y++) {
-			float v0 = (float)y / seg;
-			float v1 = (float)(y + 1) / seg;
-
-			float theta0 = v0 * glm::pi<float>();
-			float theta1 = v1 * glm::pi<float>();
-
 			for (int x = 0; x <= seg; x++) {
-				float u0 = (float)x / seg;
-				float u1 = (float)(x + 1) / seg;
-
-				float phi0 = u0 * glm::two_pi<float>();
-				float phi1 = u1 * glm::two_pi<float>();
-
 				// 4 points of the current quad
-				glm::vec3 p0 = {
-					radius * sin(theta0) * cos(phi0),
-					radius * cos(theta0),
-					radius * sin(theta0) * sin(phi0)
-				};
-				glm::vec3 p1 = {
-					radius * sin(theta1) * cos(phi0),
-					radius * cos(theta1),
-					radius * sin(theta1) * sin(phi0)
-				};
-				glm::vec3 p2 = {
-					radius * sin(theta1) * cos(phi1),
-					radius * cos(theta1),
-					radius * sin(theta1) * sin(phi1)
-				};
-				glm::vec3 p3 = {
-					radius * sin(theta0) * cos(phi1),
-					radius * cos(theta0),
-					radius * sin(theta0) * sin(phi1)
-				};
-
-				// Offset by sphere position
-				p0 += position;
-				p1 += position;
-				p2 += position;
-				p3 += position;
+				GLuint p0 = first + y * row + x;
+				GLuint p1 = first + (y + 1) * row + x;
+				GLuint p2 = first + (y + 1) * row + x + 1;
+				GLuint p3 = first + y * row + x + 1;
 
 				// Two triangles per quad
-				triangle(p0, p1, p2, color);
-				triangle(p0, p2, p3, color);
+				indices.insert(indices.end(), { p0, p1, p2, p0, p2, p3 });
 			}
 		}
 	}
@@ -519,23 +1296,23 @@ namespace Element {
 			return;
 
 		debugOn = debug;
+		revision++;
 
 		std::mt19937 rng(debugSeed);
 		std::uniform_real_distribution<float> dist(0.0f, 1.0f);
 
-		int triCount = vertacies.size() / 9;
+		// vertices are shared between triangles, so every vertex gets its own color
+		int vertexCount = vertacies.size() / 3;
 		switch (debug) {
 		case true:
 			colDebug = colors;
 			colors.clear();
-			for (int x = 0; x < triCount; x++) {
+			for (int x = 0; x < vertexCount; x++) {
 				glm::vec3 randomCol = glm::vec3(dist(rng), dist(rng), dist(rng));
-				for (int i = 0; i < 3; i++) {
-					colors.push_back(randomCol.x);
-					colors.push_back(randomCol.y);
-					colors.push_back(randomCol.z);
-					colors.push_back(1);
-				}
+				colors.push_back(randomCol.x);
+				colors.push_back(randomCol.y);
+				colors.push_back(randomCol.z);
+				colors.push_back(1);
 			}
 			break;
 		case false:
@@ -546,10 +1323,123 @@ namespace Element {
 		}
 	}
 
+	void mesh::updateBounds() {
+		if (boundsRevision == revision)
+			return;
+		boundsRevision = revision;
+
+		size_t vertexCount = vertacies.size() / 3;
+		if (!vertexCount) {
+			boundsSphere = glm::vec4(0);
+			boundsMin = boundsMax = glm::vec3(0);
+			boundsTranslucent = false;
+			return;
+		}
+		glm::vec3 min = glm::vec3(vertacies[0], vertacies[1], vertacies[2]);
+		glm::vec3 max = min;
+		for (size_t i = 1; i < vertexCount; i++) {
+			glm::vec3 point = glm::vec3(vertacies[i * 3], vertacies[i * 3 + 1], vertacies[i * 3 + 2]);
+			min = glm::min(min, point);
+			max = glm::max(max, point);
+		}
+		glm::vec3 center = (min + max) * 0.5f;
+		float radius = 0;
+		for (size_t i = 0; i < vertexCount; i++) {
+			glm::vec3 point = glm::vec3(vertacies[i * 3], vertacies[i * 3 + 1], vertacies[i * 3 + 2]);
+			radius = std::max(radius, glm::length(point - center));
+		}
+		boundsSphere = glm::vec4(center, radius);
+		boundsMin = min;
+		boundsMax = max;
+
+		boundsTranslucent = false;
+		for (size_t i = 3; i < colors.size(); i += 4) {
+			if (colors[i] < 1) {
+				boundsTranslucent = true;
+				break;
+			}
+		}
+	}
+	void mesh::setBounds(glm::vec4 sphere, glm::vec3 min, glm::vec3 max, bool translucent) {
+		boundsRevision = revision;
+		boundsSphere = sphere;
+		boundsMin = min;
+		boundsMax = max;
+		boundsTranslucent = translucent;
+	}
+	glm::vec4 mesh::boundingSphere() {
+		updateBounds();
+		return boundsSphere;
+	}
+	void mesh::boundingBox(glm::vec3& min, glm::vec3& max) {
+		updateBounds();
+		min = boundsMin;
+		max = boundsMax;
+	}
+	bool mesh::translucent() {
+		updateBounds();
+		return boundsTranslucent;
+	}
+
 	// texture --
-	texture::texture(std::string png_path) {
+	namespace {
+		// the cooked level table is checked against the header, data gets the levels without their padding
+		bool loadCooked(const std::string& path, texture& texture) {
+			std::ifstream file(path, std::ios::binary);
+			Cooked::header header;
+			if (!file.read((char*)&header, sizeof(header)) || header.magic != Cooked::magic) {
+				std::cerr << "Failed to load texture " << path << ": not a cooked texture" << std::endl;
+				return false;
+			}
+			if (header.version != Cooked::version) {
+				std::cerr << "Failed to load texture " << path << ": version " << header.version << ", expected " << Cooked::version << std::endl;
+				return false;
+			}
+			if (header.format > Cooked::blockFormat::bc3 || !header.width || !header.height || header.levels != Cooked::levelCount(header.width, header.height)) {
+				std::cerr << "Failed to load texture " << path << ": bad header" << std::endl;
+				return false;
+			}
+			std::vector<Cooked::level> levels(header.levels);
+			file.read((char*)levels.data(), sizeof(Cooked::level) * levels.size());
+			size_t bytes = 0;
+			for (uint32_t level = 0; level < header.levels; level++)
+				bytes += Cooked::levelSize(header.format, std::max(header.width >> level, 1u), std::max(header.height >> level, 1u));
+			std::vector<unsigned char> data(bytes);
+			size_t offset = 0;
+			for (uint32_t level = 0; file && level < header.levels; level++) {
+				size_t size = Cooked::levelSize(header.format, std::max(header.width >> level, 1u), std::max(header.height >> level, 1u));
+				if (levels[level].size != size) {
+					std::cerr << "Failed to load texture " << path << ": level " << level << " has " << levels[level].size << " bytes, expected " << size << std::endl;
+					return false;
+				}
+				file.seekg(levels[level].offset);
+				file.read((char*)data.data() + offset, size);
+				offset += size;
+			}
+			if (!file) {
+				std::cerr << "Failed to load texture " << path << ": file is truncated" << std::endl;
+				return false;
+			}
+			const GLenum formats[] = { GL_RGBA8, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT };
+			texture.width = header.width;
+			texture.height = header.height;
+			texture.format = formats[(uint32_t)header.format];
+			texture.levels = header.levels;
+			texture.data = std::move(data);
+			return true;
+		}
+	}
+	texture::texture(std::string png_path) : texture() {
+		if (png_path.size() > 5 && png_path.compare(png_path.size() - 5, 5, ".etex") == 0) {
+			loadCooked(png_path, *this);
+			return;
+		}
 		int w, h, c;
 		unsigned char* raw = stbi_load(png_path.c_str(), &w, &h, &c, 4);
+		if (!raw) {
+			std::cerr << "Failed to load texture " << png_path << ": " << stbi_failure_reason() << std::endl;
+			return;
+		}
 		width = w;
 		height = h;
 		channels = 4;
@@ -563,89 +1453,1119 @@ namespace Element {
 		data = { 255, 255, 255, 255 };
 	}
 
+	// texturePool --
+	texturePool::texturePool() {
+		add(&white);
+	}
+	GLuint texturePool::add(texture* texture) {
+		auto found = IDs.find(texture);
+		if (found != IDs.end()) {
+			if (found->second.revision == texture->revision)
+				return found->second.ID;
+			// new pixels may have another size, so they get a layer of their own and the old one is reused later
+			if (found->second.ID != 0)
+				arrays[found->second.ID >> 16]->releaseLayer(found->second.ID & 0xFFFF);
+			IDs.erase(found);
+		}
+
+		GLenum format = texture->format;
+		if (format != GL_RGBA8 && !glfwExtensionSupported("GL_EXT_texture_compression_s3tc")) {
+			std::cerr << "Texture pool can't use a compressed texture without GL_EXT_texture_compression_s3tc!" << std::endl;
+			IDs[texture] = { 0, texture->revision };
+			return 0;
+		}
+		// a chain is either the array's whole one or a single level whose mips are generated
+		if (texture->levels != 1 && texture->levels != (int)Cooked::levelCount(texture->width, texture->height)) {
+			std::cerr << "Texture pool needs a complete mip chain, " << texture->levels << " levels of a " << texture->width << "x" << texture->height << " texture aren't one!" << std::endl;
+			IDs[texture] = { 0, texture->revision };
+			return 0;
+		}
+		size_t array = 0;
+		while (array < arrays.size() && (arrays[array]->width != texture->width ||
+			arrays[array]->height != texture->height || arrays[array]->format != format))
+			array++;
+		if (array == arrays.size()) {
+			if (arrays.size() == maxArrays) {
+				std::cerr << "Texture pool has no array left for " << texture->width << "x" << texture->height << " textures!" << std::endl;
+				IDs[texture] = { 0, texture->revision };
+				return 0;
+			}
+			arrays.push_back(std::make_unique<GL::textureArray>(texture->width, texture->height, format));
+		}
+		// the layer is reserved now and filled by upload()
+		GLuint ID = (GLuint)(array << 16) | (GLuint)arrays[array]->addLayer();
+		IDs[texture] = { ID, texture->revision };
+		pending.push_back({ texture, ID, texture->revision });
+		return ID;
+	}
+	void texturePool::upload() {
+		if (pending.empty())
+			return;
+		if (!staging.mapped)
+			staging.stream(stagingSize);
+
+		// the copy into the PBO is all the CPU does, straight from the mapped entry for a textureCache hit,
+		// glTexSubImage3D then reads the partition on the GPU timeline and the fence keeps it from being overwritten early
+		GLubyte* out = staging.beginFrame();
+		size_t used = 0;
+		size_t sent = 0;
+		std::vector<bool> touched(arrays.size(), false);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.ID);
+		for (; sent < pending.size(); sent++) {
+			pendingUpload& upload = pending[sent];
+			// replaced since it was added, the new revision brings its own upload
+			if (upload.texture->revision != upload.revision)
+				continue;
+			GL::textureArray& array = *arrays[upload.ID >> 16];
+			size_t bytes = upload.texture->bytes();
+			const unsigned char* source;
+			if (bytes > staging.partitionSize) {
+				// never fits, straight from client memory
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				source = upload.texture->texels();
+			}
+			else {
+				if (used + bytes > staging.partitionSize)
+					break;
+				std::memcpy(out + used, upload.texture->texels(), bytes);
+				source = (const unsigned char*)(staging.partitionOffset() + used);
+				used += bytes;
+			}
+			// cooked textures bring every level, one call per level at its offset in data
+			size_t offset = 0;
+			for (int level = 0; level < upload.texture->levels; level++) {
+				GLuint levelWidth = std::max(upload.texture->width >> level, 1);
+				GLuint levelHeight = std::max(upload.texture->height >> level, 1);
+				if (array.compressed()) {
+					Cooked::blockFormat blocks = array.format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ? Cooked::blockFormat::bc1 : Cooked::blockFormat::bc3;
+					size_t size = Cooked::levelSize(blocks, levelWidth, levelHeight);
+					array.uploadCompressed(upload.ID & 0xFFFF, level, source + offset, (GLsizei)size);
+					offset += size;
+				}
+				else {
+					array.upload(upload.ID & 0xFFFF, source + offset, GL_RGBA, GL_UNSIGNED_BYTE, level);
+					offset += (size_t)levelWidth * levelHeight * 4;
+				}
+			}
+			if (bytes > staging.partitionSize)
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.ID);
+			if (upload.texture->levels == 1 && !array.compressed())
+				touched[upload.ID >> 16] = true;
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		staging.endFrame();
+		pending.erase(pending.begin(), pending.begin() + sent);
+
+		for (size_t array = 0; array < arrays.size(); array++) {
+			if (touched[array])
+				arrays[array]->generateMipmaps();
+		}
+	}
+	void texturePool::bind(GLuint firstUnit) {
+		for (size_t array = 0; array < arrays.size(); array++)
+			arrays[array]->bind(firstUnit + array);
+	}
+
+	// model --
+	mesh& model::lod(size_t level) {
+		return level == 0 ? mesh : lods[level - 1];
+	}
+	size_t model::lodLevels() const {
+		return lods.size() + 1;
+	}
+	void model::buildLODs(const std::function<void(Element::mesh& mesh, float detail)>& build, int levels, float screenSize) {
+		lods.resize(std::max(levels, 1) - 1);
+		lodScreenSize.clear();
+		float detail = 1;
+		for (size_t level = 0; level < lodLevels(); level++) {
+			// cleared in place, so the revision keeps counting up for the layers that cached the old geometry
+			Element::mesh& target = lod(level);
+			target.vertacies.clear();
+			target.colors.clear();
+			target.indices.clear();
+			target.uvs.clear();
+			target.revision++;
+			build(target, detail);
+			detail /= 2;
+			if (level > 0) {
+				lodScreenSize.push_back(screenSize);
+				screenSize /= 2;
+			}
+		}
+	}
+
+	// object --
+	void object::setModel(Element::model* model) {
+		this->model = model;
+		dirty = true;
+	}
+	void object::setTransform(const Transform& transform) {
+		this->transform = transform;
+		dirty = true;
+	}
+
+	// camera --
+	glm::mat4 camera::view() {
+		return glm::scale(glm::mat4(1), 1.0f / transform.size) *
+			glm::mat4_cast(glm::conjugate(transform.orientation())) *
+			glm::translate(glm::mat4(1), -transform.position);
+	}
+	glm::mat4 camera::projection(float aspectRatio) {
+		// x / (tan(FOV / 2) * z) and y / (tan(FOV / aspect / 2) * z) like perspective(), but with z as w so
+		// the hardware divides and clips, depth runs -1..1 from near to near + far
+		float radFOV = glm::radians(FOV);
+		float n = nearPlane;
+		float f = nearPlane + farPlane;
+		glm::mat4 projection = glm::mat4(0);
+		projection[0][0] = 1 / tan(radFOV / 2);
+		projection[1][1] = 1 / tan((radFOV / aspectRatio) / 2);
+		projection[2][2] = (f + n) / (f - n);
+		projection[2][3] = 1;
+		projection[3][2] = -2 * f * n / (f - n);
+		return projection;
+	}
+	std::array<glm::vec4, 6> camera::frustum(float aspectRatio) {
+		// Vertex.txt divides camera space x by tan(FOV / 2) * z and y by tan(FOV / aspect / 2) * z,
+		// clip space z is z / (near + far)
+		float radFOV = glm::radians(FOV);
+		float tanX = tan(radFOV / 2);
+		float tanY = tan((radFOV / aspectRatio) / 2);
+		std::array<glm::vec4, 6> planes = {
+			glm::vec4(1, 0, tanX, 0),
+			glm::vec4(-1, 0, tanX, 0),
+			glm::vec4(0, 1, tanY, 0),
+			glm::vec4(0, -1, tanY, 0),
+			glm::vec4(0, 0, 1, -nearPlane),
+			glm::vec4(0, 0, -1, nearPlane + farPlane)
+		};
+		// camera space is inverse(rotation) * (p - position) / size, move the planes back to world space
+		glm::quat rotation = transform.orientation();
+		for (glm::vec4& plane : planes) {
+			glm::vec3 normal = rotation * (glm::vec3(plane) / transform.size);
+			float distance = plane.w - glm::dot(normal, transform.position);
+			plane = glm::vec4(normal, distance) / glm::length(normal);
+		}
+		return planes;
+	}
+
 	// layer --
 	layer::layer::layer(GL::VAO* VAO) :
 		EBO(GL_DYNAMIC_DRAW),
-		posVBO(GL_DYNAMIC_DRAW),
-		colVBO(GL_DYNAMIC_DRAW),
+		vertexVBO(GL_DYNAMIC_DRAW),
+		compactVBO(GL_DYNAMIC_DRAW),
 		objectVBO(GL_DYNAMIC_DRAW),
 		texVBO(GL_DYNAMIC_DRAW),
-		texIDVBO(GL_DYNAMIC_DRAW) {
+		texIDVBO(GL_DYNAMIC_DRAW),
+		DIB(GL_DYNAMIC_DRAW),
+		boundsSSBO(GL_DYNAMIC_DRAW),
+		commandSSBO(GL_DYNAMIC_DRAW),
+		levelSSBO(GL_DYNAMIC_DRAW),
+		levelRangeSSBO(GL_DYNAMIC_DRAW),
+		lodSSBO(GL_DYNAMIC_COPY),
+		visibleACBO(GL_DYNAMIC_DRAW),
+		cameraUBO(GL_DYNAMIC_DRAW),
+		overdrawQuery(GL_SAMPLES_PASSED) {
+		visibleACBO.data = { 0, 0 };
 	}
 	layer::~layer() {}
-	void layer::render(GL::window* window, GL::shaderProgram* shader, GL::VAO* VAO) {
-		if (camera.depth) {
-			glEnable(GL_DEPTH_TEST);
-			glDepthMask(GL_TRUE);
+	void layer::writeVertices(mesh& mesh, size_t first, Element::mesh& box) {
+		size_t count = mesh.vertacies.size() / 3;
+		if (format == vertexFormat::full) {
+			vertex* out = vertexVBO.data.data() + first;
+			for (size_t i = 0; i < count; i++, out++) {
+				out->position = glm::vec3(mesh.vertacies[i * 3], mesh.vertacies[i * 3 + 1], mesh.vertacies[i * 3 + 2]);
+				out->color = glm::vec4(mesh.colors[i * 4], mesh.colors[i * 4 + 1], mesh.colors[i * 4 + 2], mesh.colors[i * 4 + 3]);
+			}
+			return;
 		}
-		else {
-			glDisable(GL_DEPTH_TEST);
-			glDepthMask(GL_FALSE);
+		// positions become 0..1 inside the bounding box, objectTransform() folds the box into the transform,
+		// coarser levels share the box of level 0 and get clamped to it
+		glm::vec3 min, max;
+		box.boundingBox(min, max);
+		glm::vec3 extent = max - min;
+		glm::vec3 scale = glm::vec3(
+			extent.x > 0 ? 65535.0f / extent.x : 0,
+			extent.y > 0 ? 65535.0f / extent.y : 0,
+			extent.z > 0 ? 65535.0f / extent.z : 0);
+		compactVertex* out = compactVBO.data.data() + first;
+		for (size_t i = 0; i < count; i++, out++) {
+			for (int axis = 0; axis < 3; axis++)
+				out->position[axis] = (GLushort)std::lround(glm::clamp((mesh.vertacies[i * 3 + axis] - min[axis]) * scale[axis], 0.0f, 65535.0f));
+			out->position.w = 0;
+			for (int channel = 0; channel < 4; channel++)
+				out->color[channel] = (GLubyte)std::lround(glm::clamp(mesh.colors[i * 4 + channel], 0.0f, 1.0f) * 255.0f);
+		}
+	}
+	void layer::writeChain(model& model, size_t firstVertex, GLuint* indices, GLuint indexOffset) {
+		// indices carry the level's offset inside the chain, plus indexOffset
+		size_t vertexOffset = 0;
+		GLuint textureID = textured ? textures.add(&model.texture) : 0;
+		for (size_t level = 0; level < model.lodLevels(); level++) {
+			mesh& mesh = model.lod(level);
+			writeVertices(mesh, firstVertex + vertexOffset, model.mesh);
+			writeIndices(indices, mesh, indexOffset + vertexOffset);
+			if (textured) {
+				size_t first = firstVertex + vertexOffset;
+				size_t count = mesh.vertacies.size() / 3;
+				if (mesh.uvs.size() == count * 2)
+					std::copy(mesh.uvs.begin(), mesh.uvs.end(), texVBO.data.begin() + first * 2);
+				else
+					std::fill(texVBO.data.begin() + first * 2, texVBO.data.begin() + (first + count) * 2, 0.0f);
+				std::fill(texIDVBO.data.begin() + first, texIDVBO.data.begin() + first + count, textureID);
+			}
+			indices += indexCount(mesh);
+			vertexOffset += mesh.vertacies.size() / 3;
+		}
+	}
+	Transform layer::objectTransform(const Transform& transform, mesh& mesh) {
+		if (format == vertexFormat::full)
+			return transform;
+		// R((q * extent + min) * size) + position == R(q * (extent * size)) + (R(min * size) + position)
+		glm::vec3 min, max;
+		mesh.boundingBox(min, max);
+		Transform folded = transform;
+		folded.position += transform.orientation() * (min * transform.size);
+		folded.size *= max - min;
+		return folded;
+	}
+	glm::vec4 layer::cullSphere(mesh& mesh) {
+		glm::vec4 sphere = mesh.boundingSphere();
+		if (format == vertexFormat::full)
+			return sphere;
+		// the same sphere in quantized space, the radius is taken against the smallest
+		// box side so scaling it by the largest folded size stays conservative
+		glm::vec3 min, max;
+		mesh.boundingBox(min, max);
+		glm::vec3 extent = max - min;
+		float smallest = FLT_MAX;
+		glm::vec3 center;
+		for (int axis = 0; axis < 3; axis++) {
+			center[axis] = extent[axis] > 0 ? (sphere[axis] - min[axis]) / extent[axis] : 0;
+			if (extent[axis] > 0)
+				smallest = std::min(smallest, extent[axis]);
+		}
+		return glm::vec4(center, smallest == FLT_MAX ? 0 : sphere.w / smallest);
+	}
+	bool layer::buildBatch() {
+		// every vertex carries its object's matrix from the start of objectVBO, a streaming one has no room for
+		// that and can't be loaded
+		if (objectVBO.mapped) {
+			std::cerr << "Batched layers can't use a streaming objectVBO!" << std::endl;
+			return false;
+		}
+		// lay the objects out back to back, a range that moved means a full rebuild
+		bool rebuild = builtMode != renderMode::batched || builtFormat != format || builtTextured != textured;
+		bool compact = format == vertexFormat::compact;
+		size_t vertexCount = 0;
+		size_t indexTotal = 0;
+		for (auto& [key, object] : objects) {
+			size_t count = object.model ? chainVertices(*object.model) : 0;
+			size_t indices = object.model ? chainIndices(*object.model) : 0;
+			if (object.firstVertex != vertexCount || object.vertexCount != count ||
+				object.firstIndex != indexTotal || object.indexCount != indices) {
+				object.firstVertex = vertexCount;
+				object.vertexCount = count;
+				object.firstIndex = indexTotal;
+				object.indexCount = indices;
+				rebuild = true;
+			}
+			vertexCount += count;
+			indexTotal += indices;
+		}
+		if (vertexCount != batchVertices || indexTotal != batchIndices)
+			rebuild = true;
+		batchVertices = vertexCount;
+		batchIndices = indexTotal;
+		builtMode = renderMode::batched;
+		builtFormat = format;
+		builtTextured = textured;
+
+		if (rebuild) {
+			vertexVBO.data.resize(compact ? 0 : vertexCount);
+			compactVBO.data.resize(compact ? vertexCount : 0);
+			objectVBO.data.resize(vertexCount * 12);
+			texVBO.data.resize(textured ? vertexCount * 2 : 0);
+			texIDVBO.data.resize(textured ? vertexCount : 0);
+			EBO.data.resize(indexTotal);
 		}
 
-		shader->useProgram();
+		rangeUploader vertexUpload(vertexVBO, 1, uploadedBytes);
+		rangeUploader compactUpload(compactVBO, 1, uploadedBytes);
+		rangeUploader objectUpload(objectVBO, 12, uploadedBytes);
+		rangeUploader texUpload(texVBO, 2, uploadedBytes);
+		rangeUploader texIDUpload(texIDVBO, 1, uploadedBytes);
+		rangeUploader indexUpload(EBO, 1, uploadedBytes);
 
-		posVBO.data.clear();
-		colVBO.data.clear();
-		objectVBO.data.clear();
-		EBO.data.clear();
+		pendingTransforms.clear();
+		pendingObjects.clear();
+		for (auto& [key, object] : objects) {
+			if (!object.vertexCount)
+				continue;
+			mesh& mesh = object.model->mesh;
+			size_t revision = chainRevision(*object.model);
+			bool meshChanged = rebuild || object.dirty || object.batchedModel != object.model || object.batchedRevision != revision;
+			// compact transforms carry the mesh bounds, so they follow mesh changes too
+			bool objectChanged = rebuild || object.dirty || object.batchedTransform != object.transform || (compact && meshChanged);
+			size_t first = object.firstVertex;
+			size_t end = first + object.vertexCount;
+
+			if (meshChanged) {
+				// indices point into the whole batch, so they carry the object's first vertex
+				writeChain(*object.model, first, EBO.data.data() + object.firstIndex, first);
+				if (compact)
+					compactUpload.add(first, end);
+				else
+					vertexUpload.add(first, end);
+				if (textured) {
+					texUpload.add(first, end);
+					texIDUpload.add(first, end);
+				}
+				indexUpload.add(object.firstIndex, object.firstIndex + object.indexCount);
+			}
+			if (objectChanged) {
+				pendingTransforms.push_back(objectTransform(object.transform, mesh));
+				pendingObjects.push_back(&object);
+			}
 
-		size_t verticiesCount = 0;
+			object.batchedModel = object.model;
+			object.batchedRevision = revision;
+			object.batchedTransform = object.transform;
+			object.dirty = false;
+		}
 
-		GLint cameraROT = glGetUniformLocation(shader->ID, "cameraRotation");
-		GLint cameraPOS = glGetUniformLocation(shader->ID, "cameraPosition");
-		GLint cameraSIZ = glGetUniformLocation(shader->ID, "cameraSize");
-		GLint cameraFOV = glGetUniformLocation(shader->ID, "cameraFOV");
+		// every vertex of an object carries a copy of its matrix
+		pendingMatrices.resize(pendingTransforms.size() * 12);
+		modelMatrices(pendingTransforms, pendingMatrices.data());
+		for (size_t i = 0; i < pendingObjects.size(); i++) {
+			object& object = *pendingObjects[i];
+			const GLfloat* matrix = pendingMatrices.data() + i * 12;
+			GLfloat* out = objectVBO.data.data() + object.firstVertex * 12;
+			for (size_t v = 0; v < object.vertexCount; v++)
+				std::copy(matrix, matrix + 12, out + v * 12);
+			objectUpload.add(object.firstVertex, object.firstVertex + object.vertexCount);
+		}
 
-		GLint aspectRatio = glGetUniformLocation(shader->ID, "aspectRatio");
-		GLint nearPlane = glGetUniformLocation(shader->ID, "nearPlane");
-		GLint farPlane = glGetUniformLocation(shader->ID, "farPlane");
+		if (rebuild) {
+			uploadedBytes += vertexVBO.loadData();
+			uploadedBytes += compactVBO.loadData();
+			uploadedBytes += objectVBO.loadData();
+			uploadedBytes += texVBO.loadData();
+			uploadedBytes += texIDVBO.loadData();
+			uploadedBytes += EBO.loadData();
+		}
+		else {
+			vertexUpload.flush();
+			compactUpload.flush();
+			objectUpload.flush();
+			texUpload.flush();
+			texIDUpload.flush();
+			indexUpload.flush();
+		}
+		return true;
+	}
+	bool layer::buildInstances() {
+		// the instance layout only changes when objects are added, removed or swap models
+		bool streaming = objectVBO.mapped != nullptr;
+		bool compact = format == vertexFormat::compact;
+		bool rebuild = (builtMode != renderMode::instanced && builtMode != renderMode::indirect) || builtFormat != format || builtTextured != textured;
+		size_t instanceCount = 0;
+		for (auto& [key, object] : objects) {
+			if (object.model != object.batchedModel)
+				rebuild = true;
+			if (object.model)
+				instanceCount++;
+		}
+		if (instanceCount != batchInstances)
+			rebuild = true;
+		for (auto& [model, range] : modelRanges) {
+			if (range.vertexCount != chainVertices(*model) || range.indexCount != chainIndices(*model))
+				rebuild = true;
+		}
+		batchInstances = instanceCount;
+		builtMode = mode;
+		builtFormat = format;
+		builtTextured = textured;
+
+		if (rebuild) {
+			layoutRevision++;
+			modelRanges.clear();
+			for (auto& [key, object] : objects) {
+				if (object.model)
+					modelRanges[object.model].instanceCount++;
+			}
+			size_t vertexCount = 0;
+			size_t indexTotal = 0;
+			size_t instanceFirst = 0;
+			for (auto& [model, range] : modelRanges) {
+				range.firstVertex = vertexCount;
+				range.vertexCount = chainVertices(*model);
+				range.firstIndex = indexTotal;
+				range.indexCount = chainIndices(*model);
+				range.firstInstance = instanceFirst;
+				vertexCount += range.vertexCount;
+				indexTotal += range.indexCount;
+				instanceFirst += range.instanceCount;
+				// reused as a cursor while the objects are placed below
+				range.instanceCount = 0;
+			}
+			batchVertices = vertexCount;
+			batchIndices = indexTotal;
+			vertexVBO.data.resize(compact ? 0 : vertexCount);
+			compactVBO.data.resize(compact ? vertexCount : 0);
+			if (!streaming)
+				objectVBO.data.resize(instanceCount * 12);
+			texVBO.data.resize(textured ? vertexCount * 2 : 0);
+			texIDVBO.data.resize(textured ? vertexCount : 0);
+			EBO.data.resize(indexTotal);
+			for (auto& [key, object] : objects) {
+				if (!object.model)
+					continue;
+				modelRange& range = modelRanges[object.model];
+				object.instance = range.firstInstance + range.instanceCount++;
+			}
+		}
 
-		glUniform4f(cameraROT, camera.transform.rotation.x, camera.transform.rotation.y, camera.transform.rotation.z, camera.transform.rotation.a);
-		glUniform3f(cameraPOS, camera.transform.position.x, camera.transform.position.y, camera.transform.position.z);
-		glUniform3f(cameraSIZ, camera.transform.size.x, camera.transform.size.y, camera.transform.size.z);
-		glUniform1f(cameraFOV, camera.FOV);
+		rangeUploader vertexUpload(vertexVBO, 1, uploadedBytes);
+		rangeUploader compactUpload(compactVBO, 1, uploadedBytes);
+		rangeUploader objectUpload(objectVBO, 12, uploadedBytes);
+		rangeUploader texUpload(texVBO, 2, uploadedBytes);
+		rangeUploader texIDUpload(texIDVBO, 1, uploadedBytes);
+		rangeUploader indexUpload(EBO, 1, uploadedBytes);
+
+		for (auto& [model, range] : modelRanges) {
+			size_t revision = chainRevision(*model);
+			if (!rebuild && range.revision == revision)
+				continue;
+			layoutRevision++;
+			// model indices stay local to the chain, draws add the first vertex as base vertex
+			writeChain(*model, range.firstVertex, EBO.data.data() + range.firstIndex, 0);
+			if (compact)
+				compactUpload.add(range.firstVertex, range.firstVertex + range.vertexCount);
+			else
+				vertexUpload.add(range.firstVertex, range.firstVertex + range.vertexCount);
+			if (textured) {
+				texUpload.add(range.firstVertex, range.firstVertex + range.vertexCount);
+				texIDUpload.add(range.firstVertex, range.firstVertex + range.vertexCount);
+			}
+			indexUpload.add(range.firstIndex, range.firstIndex + range.indexCount);
+			range.revision = revision;
+		}
+		GLfloat* stream = nullptr;
+		if (streaming) {
+			if (instanceCount * 12 > objectVBO.partitionSize) {
+				std::cerr << "Layer has more objects than its streaming objectVBO holds!" << std::endl;
+				return false;
+			}
+			// every partition is a different frame, so all matrices are written each time
+			stream = objectVBO.beginFrame();
+			instanceBase = objectVBO.partitionOffset() / 12;
+			uploadedBytes += instanceCount * 12 * sizeof(GLfloat);
+		}
+		else {
+			instanceBase = 0;
+		}
 
-		glUniform1f(aspectRatio, window->transform.size.x / window->transform.size.y);
-		glUniform1f(nearPlane, 0.1f);
-		glUniform1f(farPlane, 1000.0f);
+		// streaming converts every transform in instance order straight into the partition,
+		// otherwise only the changed ones are converted and scattered into objectVBO
+		pendingTransforms.clear();
+		pendingObjects.clear();
+		if (stream)
+			pendingTransforms.resize(instanceCount);
+		for (auto& [key, object] : objects) {
+			if (!object.model)
+				continue;
+			mesh& mesh = object.model->mesh;
+			size_t revision = chainRevision(*object.model);
+			if (stream) {
+				pendingTransforms.set(object.instance, objectTransform(object.transform, mesh));
+			}
+			else if (rebuild || object.dirty || object.batchedTransform != object.transform ||
+				(compact && object.batchedRevision != revision)) {
+				pendingTransforms.push_back(objectTransform(object.transform, mesh));
+				pendingObjects.push_back(&object);
+			}
+			object.batchedModel = object.model;
+			object.batchedRevision = revision;
+			object.batchedTransform = object.transform;
+			object.dirty = false;
+		}
+		if (stream) {
+			modelMatrices(pendingTransforms, stream);
+		}
+		else {
+			pendingMatrices.resize(pendingTransforms.size() * 12);
+			modelMatrices(pendingTransforms, pendingMatrices.data());
+			for (size_t i = 0; i < pendingObjects.size(); i++) {
+				size_t instance = pendingObjects[i]->instance;
+				std::copy(pendingMatrices.data() + i * 12, pendingMatrices.data() + i * 12 + 12, objectVBO.data.data() + instance * 12);
+				objectUpload.add(instance, instance + 1);
+			}
+		}
 
+		if (rebuild) {
+			uploadedBytes += vertexVBO.loadData();
+			uploadedBytes += compactVBO.loadData();
+			if (!streaming)
+				uploadedBytes += objectVBO.loadData();
+			uploadedBytes += texVBO.loadData();
+			uploadedBytes += texIDVBO.loadData();
+			uploadedBytes += EBO.loadData();
+		}
+		else {
+			vertexUpload.flush();
+			compactUpload.flush();
+			objectUpload.flush();
+			texUpload.flush();
+			texIDUpload.flush();
+			indexUpload.flush();
+		}
+		return true;
+	}
+	void layer::cullObjects(float aspectRatio) {
+		// world space spheres from the cached mesh spheres, the radius grows with the largest scale axis
+		objectSpheres.clear();
+		objectDepth.clear();
+		objectSlots.clear();
+		glm::vec3 forward = camera.transform.orientation() * glm::vec3(0, 0, 1);
 		for (auto& [key, object] : objects) {
-			if (!object.model) continue;
+			objectSlots.push_back(&object);
+			if (!object.model) {
+				objectSpheres.push_back(glm::vec4(0));
+				objectDepth.push_back(0);
+				continue;
+			}
+			glm::vec4 sphere = object.model->mesh.boundingSphere();
+			const Transform& transform = object.transform;
+			glm::vec3 center = transform.orientation() * (glm::vec3(sphere) * transform.size) + transform.position;
+			glm::vec3 scale = glm::abs(transform.size);
+			objectSpheres.push_back(glm::vec4(center, sphere.w * std::max(scale.x, std::max(scale.y, scale.z))));
+			objectDepth.push_back(glm::dot(center - camera.transform.position, forward));
+		}
+		selectLODs(aspectRatio);
 
-			for (int i = 0; i < (object.model->mesh.vertacies.size() / 3); i++) {
-				posVBO.data.push_back(object.model->mesh.vertacies[i * 3]);
-				posVBO.data.push_back(object.model->mesh.vertacies[i * 3 + 1]);
-				posVBO.data.push_back(object.model->mesh.vertacies[i * 3 + 2]);
+		if (!frustumCulling) {
+			objectVisible.assign(objects.size(), 1);
+			visibleObjects = objects.size();
+			return;
+		}
+		cullSpheres(objectSpheres, camera.frustum(aspectRatio), objectVisible);
+		visibleObjects = std::count(objectVisible.begin(), objectVisible.end(), 1);
+	}
+	void layer::selectLODs(float aspectRatio) {
+		// fraction of the screen height the sphere's diameter covers, Vertex.txt divides y by tan(FOV / aspect / 2) * z
+		float tanY = tan(glm::radians(camera.FOV) / aspectRatio / 2);
+		for (size_t slot = 0; slot < objectSlots.size(); slot++) {
+			object& object = *objectSlots[slot];
+			if (!object.model || !levelOfDetail) {
+				object.lod = 0;
+				continue;
+			}
+			model& model = *object.model;
+			float size = objectSpheres.radius[slot] / (std::max(objectDepth[slot], camera.nearPlane) * tanY);
+			// level i + 1 starts below lodScreenSize[i], a missing threshold never switches
+			auto threshold = [&](size_t level) {
+				return level < model.lodScreenSize.size() ? model.lodScreenSize[level] : 0.0f;
+			};
+			size_t level = std::min(object.lod, model.lodLevels() - 1);
+			while (level > 0 && size > threshold(level - 1) * (1 + lodHysteresis))
+				level--;
+			while (level + 1 < model.lodLevels() && size < threshold(level) * (1 - lodHysteresis))
+				level++;
+			object.lod = level;
+		}
+	}
+	uint16_t layer::materialKey(const model* model) {
+		// models have no GL material yet, a dense ID per model keeps the draws of each model together in the
+		// render queue, only past 32768 models in one frame do two of them share a key
+		return materialIDs.emplace(model, (uint16_t)materialIDs.size()).first->second;
+	}
+	void layer::buildBatchDraws(GLuint program) {
+		queue.clear();
+		materialIDs.clear();
+		for (size_t slot = 0; slot < objectSlots.size(); slot++) {
+			object& object = *objectSlots[slot];
+			if (!objectVisible[slot] || !object.indexCount)
+				continue;
+			queue.push(renderQueue::key(0, object.model->lod(object.lod).translucent(), program, materialKey(object.model), objectDepth[slot]), slot);
+		}
+		queue.sort();
+
+		// one draw per run of queued objects that sit next to each other in the EBO,
+		// runs don't cross from the opaque into the translucent part of the queue
+		batchCounts.clear();
+		batchOffsets.clear();
+		opaqueDraws = SIZE_MAX;
+		submittedTriangles = 0;
+		size_t runEnd = SIZE_MAX;
+		for (const renderQueue::item& item : queue.items) {
+			object& object = *objectSlots[item.index];
+			if (opaqueDraws == SIZE_MAX && (item.key & renderQueue::translucentBit)) {
+				opaqueDraws = batchCounts.size();
+				runEnd = SIZE_MAX;
+			}
+			// only the selected level's part of the object's chain
+			auto [first, count] = lodIndices(*object.model, object.lod);
+			first += object.firstIndex;
+			if (first == runEnd) {
+				batchCounts.back() += count;
+			}
+			else {
+				batchCounts.push_back(count);
+				batchOffsets.push_back((void*)(first * sizeof(GLuint)));
+			}
+			runEnd = first + count;
+			submittedTriangles += count / 3;
+		}
+		opaqueDraws = std::min(opaqueDraws, batchCounts.size());
+	}
+	void layer::buildDraws(GLuint program) {
+		instanceVisible.assign(batchInstances, 0);
+		instanceDepth.assign(batchInstances, 0);
+		instanceLOD.assign(batchInstances, 0);
+		for (size_t slot = 0; slot < objectSlots.size(); slot++) {
+			object& object = *objectSlots[slot];
+			if (objectVisible[slot] && object.model) {
+				instanceVisible[object.instance] = 1;
+				instanceDepth[object.instance] = objectDepth[slot];
+				instanceLOD[object.instance] = (uint8_t)object.lod;
+			}
+		}
+		// opaque models get one command per run of visible instances at the same level, keyed by the nearest
+		// instance, translucent ones a command per instance so they can be drawn back to front, unless
+		// weighted blending makes the order irrelevant
+		bool sortTranslucent = !weightedBlending;
+		queue.clear();
+		materialIDs.clear();
+		queuedDraws.clear();
+		for (auto& [model, range] : modelRanges) {
+			if (!range.indexCount)
+				continue;
+			uint16_t material = materialKey(model);
+			size_t end = range.firstInstance + range.instanceCount;
+			for (size_t i = range.firstInstance; i < end;) {
+				if (!instanceVisible[i]) {
+					i++;
+					continue;
+				}
+				size_t first = i;
+				uint8_t level = instanceLOD[i];
+				bool translucent = model->lod(level).translucent();
+				bool split = translucent && sortTranslucent;
+				float depth = FLT_MAX;
+				while (i < end && instanceVisible[i] && instanceLOD[i] == level && (i == first || !split)) {
+					depth = std::min(depth, instanceDepth[i]);
+					i++;
+				}
+				auto [firstIndex, count] = lodIndices(*model, level);
+				if (!count)
+					continue;
+				queue.push(renderQueue::key(0, translucent, program, material, depth), queuedDraws.size());
+				queuedDraws.push_back({
+					(GLuint)count,
+					(GLuint)(i - first),
+					(GLuint)(range.firstIndex + firstIndex),
+					(GLint)range.firstVertex,
+					(GLuint)(first + instanceBase) });
+			}
+		}
+		queue.sort();
+		draws.clear();
+		opaqueDraws = SIZE_MAX;
+		submittedTriangles = 0;
+		for (const renderQueue::item& item : queue.items) {
+			if (opaqueDraws == SIZE_MAX && (item.key & renderQueue::translucentBit))
+				opaqueDraws = draws.size();
+			draws.push_back(queuedDraws[item.index]);
+			submittedTriangles += draws.back().count / 3 * draws.back().instanceCount;
+		}
+		opaqueDraws = std::min(opaqueDraws, draws.size());
+	}
+	void layer::uploadDraws() {
+		// only resent when the visible runs changed or the DIB was last used by cull()
+		if (commandRevision != layoutRevision || DIB.data.size() != draws.size() ||
+			std::memcmp(DIB.data.data(), draws.data(), draws.size() * sizeof(GL::DrawElementsIndirectCommand))) {
+			commandRevision = layoutRevision;
+			DIB.data = draws;
+			uploadedBytes += DIB.loadData();
+			cullRevision = 0;
+		}
+	}
+	size_t layer::queuedDrawCount() {
+		return mode == renderMode::batched ? batchCounts.size() : draws.size();
+	}
+	void layer::drawQueued(size_t first, size_t end) {
+		if (first >= end)
+			return;
 
-				objectVBO.data.push_back(object.transform.position.x);
-				objectVBO.data.push_back(object.transform.position.y);
-				objectVBO.data.push_back(object.transform.position.z);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO.ID);
+		switch (mode) {
+		case renderMode::batched:
+			glMultiDrawElements(GL_TRIANGLES, batchCounts.data() + first, GL_UNSIGNED_INT, batchOffsets.data() + first, end - first);
+			break;
+		case renderMode::instanced:
+			drawDirect(first, end);
+			break;
+		case renderMode::indirect:
+			DIB.bind();
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(first * sizeof(GL::DrawElementsIndirectCommand)), end - first, 0);
+			DIB.unbind();
+			break;
+		}
+	}
+	void layer::drawDirect(size_t first, size_t end) {
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO.ID);
+		for (size_t i = first; i < end; i++) {
+			GL::DrawElementsIndirectCommand& draw = draws[i];
+			glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, draw.count, GL_UNSIGNED_INT,
+				(void*)(draw.firstIndex * sizeof(GLuint)), draw.instanceCount, draw.baseVertex, draw.baseInstance);
+		}
+	}
+	bool layer::usePrePass(GL::window* window) {
+		// picks up the last measurement once the GPU has it, the lower bar to switch back keeps it from flickering
+		if (overdrawPending && overdrawQuery.available()) {
+			overdrawPending = false;
+			float pixels = std::max(window->transform.size.x * window->transform.size.y, 1.0f);
+			overdraw = overdrawQuery.result() / pixels;
+			if (!prePassActive && overdraw > prePassThreshold)
+				prePassActive = true;
+			else if (prePassActive && overdraw < prePassThreshold * 0.75f)
+				prePassActive = false;
+		}
+		if (!camera.depth)
+			return false;
+		switch (camera.prePass) {
+		case prePassMode::off:
+			return false;
+		case prePassMode::on:
+			return true;
+		default:
+			return prePassActive;
+		}
+	}
+	void layer::drawOpaque(GL::window* window, GL::shaderProgram* shader, GL::shaderProgram* depth, const std::function<void()>& draw) {
+		// the first opaque pass is the one that shows the overdraw, with or without a pre-pass, which needs
+		// a depth variant that writes exactly the depth the shaded pass tests against
+		bool prePass = usePrePass(window) && depth && depth->ready();
+		bool measure = !overdrawPending;
+		if (measure)
+			overdrawQuery.begin();
+		if (prePass) {
+			depth->useProgram();
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		}
+		draw();
+		if (measure) {
+			overdrawQuery.end();
+			overdrawPending = true;
+		}
+		if (!prePass)
+			return;
 
-				objectVBO.data.push_back(object.transform.rotation.x);
-				objectVBO.data.push_back(object.transform.rotation.y);
-				objectVBO.data.push_back(object.transform.rotation.z);
-				objectVBO.data.push_back(object.transform.rotation.a);
+		// every visible fragment now matches the depth buffer, so only those get shaded
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glDepthMask(GL_FALSE);
+		glDepthFunc(GL_LEQUAL);
+		shader->useProgram();
+		draw();
+		glDepthFunc(GL_LESS);
+		glDepthMask(GL_TRUE);
+	}
+	void layer::drawWeighted(GL::window* window, GL::VAO* VAO, GL::shaderProgram* oit, const std::function<void()>& draw) {
+		int width = window->transform.size.x;
+		int height = window->transform.size.y;
+		oitTarget.create(width, height, { GL_RGBA16F, GL_R16F }, GL_DEPTH24_STENCIL8);
+
+		// translucent fragments behind opaque ones are still rejected, so copy the opaque depth over
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, oitTarget.ID);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+		// accumulation sums weighted premultiplied colors, revealage multiplies (1 - alpha)
+		oitTarget.bind();
+		GLfloat accumulationClear[4] = { 0, 0, 0, 0 };
+		GLfloat revealageClear[4] = { 1, 1, 1, 1 };
+		glClearBufferfv(GL_COLOR, 0, accumulationClear);
+		glClearBufferfv(GL_COLOR, 1, revealageClear);
+		glDepthMask(GL_FALSE);
+		glBlendFunci(0, GL_ONE, GL_ONE);
+		glBlendFunci(1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+
+		oit->useProgram();
+		VAO->bind();
+		draw();
+
+		// full screen triangle that resolves the average color over the opaque image
+		oitTarget.unbind();
+		glDisable(GL_DEPTH_TEST);
+		glBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
+		compositeProgram->useProgram();
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, oitTarget.colors[0]);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, oitTarget.colors[1]);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		VAO->unbind();
 
-				objectVBO.data.push_back(object.transform.size.x);
-				objectVBO.data.push_back(object.transform.size.y);
-				objectVBO.data.push_back(object.transform.size.z);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		if (camera.depth) {
+			glEnable(GL_DEPTH_TEST);
+			glDepthMask(GL_TRUE);
+		}
+	}
+	void layer::cull(float aspectRatio) {
+		// one single-instance command, model space sphere and LOD chain per object, only resent when the layout
+		// changed. Opaque objects go first so the opaque and translucent draws can be compacted into separate ranges
+		if (cullRevision != layoutRevision) {
+			cullRevision = layoutRevision;
+			commandRevision = 0;
+			boundsSSBO.data.clear();
+			commandSSBO.data.clear();
+			levelSSBO.data.clear();
+			levelRangeSSBO.data.clear();
+			lodSSBO.data.clear();
+			culledOpaque = 0;
+			for (int translucent = 0; translucent < 2; translucent++) {
+				for (auto& [key, object] : objects) {
+					if (!object.model || object.model->mesh.translucent() != (translucent != 0))
+						continue;
+					modelRange& range = modelRanges[object.model];
+					if (!range.indexCount)
+						continue;
+					model& model = *object.model;
+					boundsSSBO.data.push_back(cullSphere(model.mesh));
+					// count and firstIndex are replaced by those of the level Cull.txt picks
+					commandSSBO.data.push_back({
+						(GLuint)indexCount(model.mesh),
+						1,
+						(GLuint)range.firstIndex,
+						(GLint)range.firstVertex,
+						(GLuint)object.instance });
+					levelRangeSSBO.data.push_back(glm::uvec2(levelSSBO.data.size(), model.lodLevels()));
+					for (size_t level = 0; level < model.lodLevels(); level++) {
+						auto [firstIndex, count] = lodIndices(model, level);
+						levelSSBO.data.push_back({
+							level < model.lodScreenSize.size() ? model.lodScreenSize[level] : 0.0f,
+							(GLuint)count,
+							(GLuint)(range.firstIndex + firstIndex),
+							0 });
+					}
+					lodSSBO.data.push_back((GLuint)std::min(object.lod, model.lodLevels() - 1));
+				}
+				if (!translucent)
+					culledOpaque = commandSSBO.data.size();
+			}
+			uploadedBytes += boundsSSBO.loadData();
+			uploadedBytes += commandSSBO.loadData();
+			uploadedBytes += levelSSBO.loadData();
+			uploadedBytes += levelRangeSSBO.loadData();
+			uploadedBytes += lodSSBO.loadData();
+			// the compacted output, sized for the case where everything is visible
+			DIB.data.assign(commandSSBO.data.size(), {});
+			uploadedBytes += DIB.loadData();
+		}
+		GLuint objectCount = commandSSBO.data.size();
+		if (!objectCount)
+			return;
+
+		// without GL_ARB_indirect_parameters every slot is drawn, so the unused tail has to be empty draws
+		auto drawCount = multiDrawElementsIndirectCount();
+		if (!drawCount) {
+			DIB.bind();
+			glClearBufferData(GL_DRAW_INDIRECT_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+			DIB.unbind();
+		}
+		uploadedBytes += visibleACBO.loadData();
+
+		if (cullProgramID != cullProgram->ID) {
+			cullProgramID = cullProgram->ID;
+			cullFrustum = cullProgram->getUniform<glm::vec4>("frustum");
+			cullObjectCount = cullProgram->getUniform<GLuint>("objectCount");
+			cullInstanceOffset = cullProgram->getUniform<GLuint>("instanceOffset");
+			cullTranslucentFirst = cullProgram->getUniform<GLuint>("translucentFirst");
+			cullCameraPosition = cullProgram->getUniform<glm::vec3>("cameraPosition");
+			cullCameraForward = cullProgram->getUniform<glm::vec3>("cameraForward");
+			cullTanY = cullProgram->getUniform<GLfloat>("tanY");
+			cullNearPlane = cullProgram->getUniform<GLfloat>("nearPlane");
+			cullHysteresis = cullProgram->getUniform<GLfloat>("lodHysteresis");
+			cullLevelLimit = cullProgram->getUniform<GLuint>("levelLimit");
+		}
+		std::array<glm::vec4, 6> planes = camera.frustum(aspectRatio);
+		cullFrustum.set(planes.data(), 6);
+		cullObjectCount.set(objectCount);
+		cullInstanceOffset.set((GLuint)instanceBase);
+		cullTranslucentFirst.set((GLuint)culledOpaque);
+		// the same projected size selectLODs() works with
+		cullCameraPosition.set(camera.transform.position);
+		cullCameraForward.set(camera.transform.orientation() * glm::vec3(0, 0, 1));
+		cullTanY.set(tan(glm::radians(camera.FOV) / aspectRatio / 2));
+		cullNearPlane.set(camera.nearPlane);
+		cullHysteresis.set(lodHysteresis);
+		cullLevelLimit.set(levelOfDetail ? UINT32_MAX : 1);
+		cullProgram->useProgram();
+
+		boundsSSBO.bindBase(0);
+		commandSSBO.bindBase(1);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, objectVBO.ID);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, DIB.ID);
+		levelSSBO.bindBase(4);
+		levelRangeSSBO.bindBase(5);
+		lodSSBO.bindBase(6);
+		visibleACBO.bindBase(0);
+		glDispatchCompute((objectCount + 63) / 64, 1, 1);
+		// the next dispatch reads the levels this one wrote
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+	void layer::drawCulled(bool translucent) {
+		// the opaque range starts at 0 and is counted by the first counter, the translucent one starts at
+		// culledOpaque and is counted by the second
+		size_t first = translucent ? culledOpaque : 0;
+		size_t end = translucent ? commandSSBO.data.size() : culledOpaque;
+		if (first >= end)
+			return;
+		auto drawCount = multiDrawElementsIndirectCount();
+		const void* offset = (const void*)(first * sizeof(GL::DrawElementsIndirectCommand));
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO.ID);
+		DIB.bind();
+		if (drawCount) {
+			glBindBuffer(GL_PARAMETER_BUFFER_ARB, visibleACBO.ID);
+			drawCount(GL_TRIANGLES, GL_UNSIGNED_INT, offset, translucent ? sizeof(GLuint) : 0, (GLsizei)(end - first), 0);
+			glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+		}
+		else {
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, offset, (GLsizei)(end - first), 0);
+		}
+		DIB.unbind();
+	}
+	uint32_t layer::shaderFeatures() const {
+		uint32_t features = 0;
+		if (textured)
+			features |= shaderFeature::textured;
+		if (vertexColors)
+			features |= shaderFeature::vertexColor;
+		return features;
+	}
+	void layer::render(GL::window* window, GL::shaderPermutations* shaders, GL::VAO* VAO) {
+		draw(window, shaders->get(shaderFeatures()), shaders, VAO);
+	}
+	void layer::render(GL::window* window, GL::shaderProgram* shader, GL::VAO* VAO) {
+		draw(window, shader, nullptr, VAO);
+	}
+	void layer::draw(GL::window* window, GL::shaderProgram* shader, GL::shaderPermutations* variants, GL::VAO* VAO) {
+		// programs still building are left out, the frame draws with fallbackProgram or not at all
+		if (!shader->ready()) {
+			if (!fallbackProgram || !fallbackProgram->ready())
+				return;
+			shader = fallbackProgram;
+			variants = nullptr;
+		}
+		// the variant is only asked for, and so built, once the camera wants a pre-pass
+		GL::shaderProgram* depth = variants && camera.depth && camera.prePass != prePassMode::off ?
+			variants->get(shaderFeatures() | shaderFeature::depthOnly) : nullptr;
+		GL::shaderProgram* oit = variants && blending == blendMode::weighted ?
+			variants->get(shaderFeatures() | shaderFeature::oit) : nullptr;
+		if (camera.depth) {
+			glEnable(GL_DEPTH_TEST);
+			glDepthMask(GL_TRUE);
+		}
+		else {
+			glDisable(GL_DEPTH_TEST);
+			glDepthMask(GL_FALSE);
+		}
 
-				colVBO.data.push_back(object.model->mesh.colors[i * 4]);
-				colVBO.data.push_back(object.model->mesh.colors[i * 4 + 1]);
-				colVBO.data.push_back(object.model->mesh.colors[i * 4 + 2]);
-				colVBO.data.push_back(object.model->mesh.colors[i * 4 + 3]);
+		shader->useProgram();
 
-				EBO.data.push_back(verticiesCount++);
+		uploadedBytes = 0;
+		submittedTriangles = 0;
+		float aspectRatio = window->transform.size.x / window->transform.size.y;
+		// a rotation without an axis is no rotation, Vertex.txt then gets a valid axis instead of checking for it per vertex
+		glm::vec4 rotation = camera.transform.rotation;
+		if (rotation.x == 0 && rotation.y == 0 && rotation.z == 0)
+			rotation = glm::vec4(0, 0, 1, 0);
+		cameraBlock block = {
+			rotation,
+			camera.transform.position,
+			camera.FOV,
+			camera.transform.size,
+			aspectRatio,
+			camera.nearPlane,
+			camera.farPlane,
+			glm::vec2(0),
+			camera.projection(aspectRatio) * camera.view()
+		};
+		if (cameraUBO.data.empty() || std::memcmp(&block, cameraUBO.data.data(), sizeof(cameraBlock))) {
+			cameraUBO.data = { block };
+			uploadedBytes += cameraUBO.loadData();
+		}
+		cameraUBO.bindBase(cameraBlock::binding);
+
+		bool weighted = oit && oit->ready() && compositeProgram && compositeProgram->ready();
+		weightedBlending = weighted;
+		// Cull.txt appends visible draws in any order, the translucent ones after the opaque ones but unsorted
+		bool gpuCulled = mode == renderMode::indirect && cullProgram && cullProgram->ready();
+		switch (mode) {
+		case renderMode::batched:
+			if (!buildBatch())
+				return;
+			cullObjects(aspectRatio);
+			buildBatchDraws(shader->ID);
+			break;
+		case renderMode::instanced:
+		case renderMode::indirect:
+			if (!buildInstances())
+				return;
+			if (gpuCulled) {
+				cull(aspectRatio);
+				shader->useProgram();
+				// Cull.txt's translucent draws come out unsorted, which only weighted blending can take, so
+				// otherwise they're queued back to front on the CPU and drawn without the DIB it wrote
+				if (!weighted && culledOpaque < commandSSBO.data.size()) {
+					cullObjects(aspectRatio);
+					buildDraws(shader->ID);
+				}
+				else {
+					draws.clear();
+					opaqueDraws = 0;
+				}
+				break;
 			}
+			cullObjects(aspectRatio);
+			buildDraws(shader->ID);
+			if (mode == renderMode::indirect)
+				uploadDraws();
+			break;
 		}
-		posVBO.loadData();
-		colVBO.loadData();
-		objectVBO.loadData();
-		EBO.loadData();
 
+		// textures picked up while the batch was built go up before the first draw samples them
+		if (textured) {
+			textures.upload();
+			textures.bind();
+		}
 		VAO->bind();
-		EBO.draw();
+		// objectVBO's matrices step per vertex in batched mode and per instance otherwise, whatever the VAO was
+		// configured with
+		GLuint divisor = mode == renderMode::batched ? 0 : 1;
+		for (const GL::vertexAttribute& attribute : GL::vertexLayout<objectRecord>::attributes)
+			glVertexAttribDivisor(attribute.index, divisor);
+		if (gpuCulled) {
+			drawOpaque(window, shader, depth, [&] { drawCulled(false); });
+			if (!weighted)
+				drawDirect(opaqueDraws, draws.size());
+			else if (culledOpaque < commandSSBO.data.size())
+				drawWeighted(window, VAO, oit, [&] { drawCulled(true); });
+		}
+		else {
+			drawOpaque(window, shader, depth, [&] { drawQueued(0, opaqueDraws); });
+			if (weighted && opaqueDraws < queuedDrawCount())
+				drawWeighted(window, VAO, oit, [&] { drawQueued(opaqueDraws, queuedDrawCount()); });
+			else
+				drawQueued(opaqueDraws, queuedDrawCount());
+		}
 		VAO->unbind();
+		if (mode != renderMode::batched && objectVBO.mapped)
+			objectVBO.endFrame();
 	}
 }
\ No newline at end of file
@@ -3,6 +3,15 @@
 #include "attributes.h"
 
 namespace GL {
+    // layout glMultiDrawElementsIndirect expects for every draw in a DIB
+    struct DrawElementsIndirectCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
     template<typename T>
 	class buffer {
 	public:
@@ -14,8 +23,23 @@ namespace GL {
         std::vector<T> data;
         GLenum dataType;
 
+        // streaming mode: persistently mapped storage split into one partition per frame in flight
+        T* mapped = nullptr;
+        size_t partitionSize = 0;
+        int partitions = 0;
+        int partition = 0;
+        std::vector<GLsync> fences;
+
         buffer();
         ~buffer();
+
+        // replaces the buffer with immutable storage for count elements per frame, reconfigure VAOs after this
+        void stream(size_t count, int frames = 3);
+        // waits until the GPU is done with the next partition and returns it for writing
+        T* beginFrame();
+        // fences the current partition, call after the draws that read it
+        void endFrame();
+        size_t partitionOffset();
 	};
     // finish buffers
     namespace Buffer {
@@ -40,41 +64,47 @@ namespace GL {
             VBO(GLenum usage = GL_STATIC_DRAW);
             void bind();
             void unbind();
-            void loadData();
+            // both refuse streamed storage (buffer::stream), that's written through beginFrame()
+            size_t loadData();
+            size_t loadRange(size_t first, size_t count);
         };
         // Element Buffer Object (Index Buffer)
         class EBO : public buffer<GLuint> {
         public:
             EBO(GLenum usage = GL_STATIC_DRAW);
-            void loadData();
+            size_t loadData();
+            size_t loadRange(size_t first, size_t count);
             void draw();
         };
         // Uniform Buffer Object
         template<typename T>
         class UBO : public buffer<T> {
         public:
-            UBO(GLenum usage = GL_STATIC_DRAW) {
-                this->type = GL_UNIFORM_BUFFER;
-                this->usage = usage;
-            }
+            UBO(GLenum usage = GL_STATIC_DRAW);
+            void bind();
+            void unbind();
+            void bindBase(GLuint index);
+            size_t loadData();
         };
         // Shader Storage Buffer Object
         template<typename T>
         class SSBO : public buffer<T> {
         public:
-            SSBO(GLenum usage = GL_DYNAMIC_COPY) {
-                this->type = GL_SHADER_STORAGE_BUFFER;
-                this->usage = usage;
-            }
+            SSBO(GLenum usage = GL_DYNAMIC_COPY);
+            void bind();
+            void unbind();
+            void bindBase(GLuint index);
+            size_t loadData();
         };
         // Atomic Counter Buffer
         template<typename T>
         class ACBO : public buffer<T> {
         public:
-            ACBO(GLenum usage = GL_DYNAMIC_DRAW) {
-                this->type = GL_ATOMIC_COUNTER_BUFFER;
-                this->usage = usage;
-            }
+            ACBO(GLenum usage = GL_DYNAMIC_DRAW);
+            void bind();
+            void unbind();
+            void bindBase(GLuint index);
+            size_t loadData();
         };
         // Transform Feedback Buffer
         template<typename T>
@@ -140,10 +170,10 @@ namespace GL {
         template<typename T>
         class DIB : public buffer<T> {
         public:
-            DIB(GLenum usage = GL_STATIC_DRAW) {
-                this->type = GL_DRAW_INDIRECT_BUFFER;
-                this->usage = usage;
-            }
+            DIB(GLenum usage = GL_STATIC_DRAW);
+            void bind();
+            void unbind();
+            size_t loadData();
         };
         // Dispatch Indirect Buffer
         template<typename T>
@@ -165,32 +195,251 @@ namespace GL {
         };
     }
 
+    // how integer attribute data reaches the shader
+    enum class attribFormat {
+        scaled,     // converted to float as is
+        normalized, // unsigned types map to [0, 1], signed to [-1, 1]
+        integer     // stays an integer, read as int/uint/ivec in the shader
+    };
+
+    // one attribute of an interleaved vertex, offset and stride are in bytes
+    struct vertexAttribute {
+        GLuint index;
+        GLint size;
+        GLenum type;
+        size_t offset;
+        attribFormat format;
+    };
+    // component count and GL type of everything a vertex member can be
+    template<typename T> struct attribType;
+    template<> struct attribType<GLfloat>  { static constexpr GLint size = 1; static constexpr GLenum type = GL_FLOAT; };
+    template<> struct attribType<GLint>    { static constexpr GLint size = 1; static constexpr GLenum type = GL_INT; };
+    template<> struct attribType<GLuint>   { static constexpr GLint size = 1; static constexpr GLenum type = GL_UNSIGNED_INT; };
+    template<> struct attribType<GLshort>  { static constexpr GLint size = 1; static constexpr GLenum type = GL_SHORT; };
+    template<> struct attribType<GLushort> { static constexpr GLint size = 1; static constexpr GLenum type = GL_UNSIGNED_SHORT; };
+    template<> struct attribType<GLbyte>   { static constexpr GLint size = 1; static constexpr GLenum type = GL_BYTE; };
+    template<> struct attribType<GLubyte>  { static constexpr GLint size = 1; static constexpr GLenum type = GL_UNSIGNED_BYTE; };
+    template<glm::length_t L, typename T, glm::qualifier Q>
+    struct attribType<glm::vec<L, T, Q>> {
+        static constexpr GLint size = L;
+        static constexpr GLenum type = attribType<T>::type;
+    };
+    // attribute for a member of type Member at offset, use offsetof(vertex, member)
+    template<typename Member>
+    constexpr vertexAttribute attribute(GLuint index, size_t offset, attribFormat format = attribFormat::scaled) {
+        return { index, attribType<Member>::size, attribType<Member>::type, offset, format };
+    }
+    // specialize with a static constexpr array named attributes to make Vertex usable with VAO::configure<Vertex>
+    template<typename Vertex> struct vertexLayout;
+
     class VAO {
     private:
         GLuint ID;
+
+        void attribute(const vertexAttribute& attribute, GLsizei stride, GLuint divisor);
     public:
         VAO();
         ~VAO();
 
         void bind();
         void unbind();
+        // single attribute, sizes and offsets counted in elements of T
         template<typename T>
-        void configure(buffer<T>* buffer, GLuint index, GLint size, int vertexSize, int offSet);
+        void configure(buffer<T>* buffer, GLuint index, GLint size, int vertexSize, int offSet, GLuint divisor = 0, attribFormat format = attribFormat::scaled) {
+            bind();
+            glBindBuffer(buffer->type, buffer->ID);
+            attribute({ index, size, buffer->dataType, offSet * sizeof(T), format }, vertexSize * sizeof(T), divisor);
+            unbind();
+        }
+        // every attribute of vertexLayout<Vertex>, Vertex defaults to the buffer element type but can
+        // also describe a record spread over several elements (e.g. 12 floats per object)
+        template<typename Vertex = void, typename T>
+        void configure(buffer<T>* buffer, GLuint divisor = 0) {
+            using layout = std::conditional_t<std::is_void_v<Vertex>, T, Vertex>;
+            static_assert(sizeof(layout) % sizeof(T) == 0, "vertex layout doesn't line up with the buffer elements");
+            bind();
+            glBindBuffer(buffer->type, buffer->ID);
+            for (const vertexAttribute& attribute : vertexLayout<layout>::attributes)
+                this->attribute(attribute, sizeof(layout), divisor);
+            unbind();
+        }
+    };
+
+    // handle to a uniform of a linked program, set through glProgramUniform so the program doesn't have to be bound
+    template<typename T>
+    class uniform {
+    public:
+        GLuint program = 0;
+        GLint location = -1;
+
+        void set(const T& value);
+        void set(const T* values, GLsizei count);
+    };
+
+    enum class programStatus {
+        empty,
+        building,
+        ready,
+        failed
     };
 
 	class shaderProgram {
     public:
+        struct uniformInfo {
+            GLint location;
+            GLenum type;
+            GLint size;
+        };
+
+        struct stage {
+            GLenum type;
+            std::string path;
+            std::string source;
+            // source with its #includes expanded and the defines added, what gets compiled and hashed
+            std::string expanded = {};
+            // the file of every source string number in expanded's #line directives, path first
+            std::vector<std::string> files = {};
+        };
+
 		GLuint ID;
+        // read by addShader(), compiled and attached by compile()
+        std::vector<stage> stages;
         std::vector<GLuint> shaderIDs;
+        programStatus status = programStatus::empty;
+        // filled by compile() from the linked program
+        std::map<std::string, uniformInfo> uniforms;
+        std::map<std::string, GLuint> uniformBlocks;
+        // #define name value lines build() puts after every stage's #version
+        std::map<std::string, std::string> defines;
+
+        // linked programs are kept here as glGetProgramBinary output when it's set, keyed by a hash of the
+        // stage sources and the driver's vendor, renderer and version, empty turns the cache off
+        static std::string binaryCache;
+        // compile() calls that found their binary and ones that had to compile
+        static size_t binaryHits;
+        static size_t binaryMisses;
 
 		shaderProgram();
 		~shaderProgram();
 
 		void addShader(GLenum shaderType, const std::string& shaderFilePath);
+		// loads the cached binary when there's one the driver accepts, otherwise compiles the stages and links,
+		// and waits for the result
 		void compile();
+		// compile() without the wait: every stage and the link are submitted and ready() picks the result up,
+		// with GL_KHR_parallel_shader_compile the driver works on them on its own threads meanwhile.
+		// #include "file" lines are replaced by the file, relative to the one including it and once per stage
+		void build();
+		// true once the program is linked, a build in flight is polled without blocking when the driver has
+		// GL_KHR_parallel_shader_compile and waited for otherwise
+		bool ready();
 		void useProgram();
+
+        // look a uniform up once and keep the handle, arrays are found by their name without [0]
+        template<typename T>
+        uniform<T> getUniform(const std::string& name);
+        void bindBlock(const std::string& name, GLuint binding);
+    private:
+        void reflect();
+        // binary file of the build in flight, empty without binaryCache
+        std::string cachePath;
+        bool fromBinary = false;
+
+        void submitStages();
+        // reads the link status and logs, a rejected binary goes back to building from the stages
+        void finish();
+        void preprocess(stage& stage);
+        void expand(const std::string& path, const std::string& source, stage& stage);
+        std::string binaryPath();
+        bool loadBinary(const std::string& path);
+        void saveBinary(const std::string& path);
 	};
 
+    // variants of one set of stages, one shaderProgram per feature bitmask: bit i defines features[i] as 1
+    // or 0 and the shaders leave out what a variant doesn't use with #if
+    class shaderPermutations {
+    public:
+        std::vector<std::string> features;
+
+        shaderPermutations(std::vector<std::string> features);
+
+        void addShader(GLenum shaderType, const std::string& shaderFilePath);
+        // the variant for mask, built (shaderProgram::build) the first time it's asked for
+        shaderProgram* get(uint32_t mask);
+    private:
+        std::vector<std::pair<GLenum, std::string>> stageFiles;
+        std::map<uint32_t, std::unique_ptr<shaderProgram>> programs;
+    };
+
+    // framebuffer object with texture color attachments and an optional depth renderbuffer
+    class framebuffer {
+    public:
+        GLuint ID;
+        std::vector<GLuint> colors;
+        GLuint depth = 0;
+        int width = 0;
+        int height = 0;
+
+        framebuffer();
+        ~framebuffer();
+
+        // (re)creates the attachments, does nothing while the size and formats stay the same
+        void create(int width, int height, const std::vector<GLenum>& colorFormats, GLenum depthFormat = GL_NONE);
+        void bind();
+        void unbind();
+    private:
+        std::vector<GLenum> colorFormats;
+        GLenum depthFormat = GL_NONE;
+
+        void release();
+    };
+
+    // GL query object, e.g. GL_TIME_ELAPSED or GL_SAMPLES_PASSED around a group of draws
+    class query {
+    public:
+        GLuint ID;
+        GLenum target;
+
+        query(GLenum target);
+        ~query();
+
+        void begin();
+        void end();
+        bool available();
+        // waits for the GPU when the result isn't available yet
+        GLuint64 result();
+    };
+
+    // GL_TEXTURE_2D_ARRAY with immutable storage and a full mip chain, layers of the same size and format
+    class textureArray {
+    public:
+        GLuint ID = 0;
+        int width;
+        int height;
+        GLenum format;
+        int levels;
+        int layers = 0;
+        int capacity = 0;
+
+        textureArray(int width, int height, GLenum format = GL_RGBA8);
+        ~textureArray();
+
+        // reserves a released layer or the next one, the storage is reallocated at twice the size and copied when it's full
+        int addLayer();
+        void releaseLayer(int layer);
+        // one level of one layer, pixels is an offset while a PBO_Unpack is bound
+        void upload(int layer, const void* pixels, GLenum pixelFormat = GL_RGBA, GLenum pixelType = GL_UNSIGNED_BYTE, int level = 0);
+        // one level of one layer of a block compressed array, size is the bytes of the level's blocks
+        void uploadCompressed(int layer, int level, const void* blocks, GLsizei size);
+        bool compressed() const;
+        void generateMipmaps();
+        void bind(GLuint unit);
+    private:
+        std::vector<int> freeLayers;
+
+        void reserve(int capacity);
+    };
+
     class window {
     public:
         GLFWwindow* ID;
@@ -222,7 +471,24 @@ namespace Element {
         std::vector<GLfloat> vertacies;
         std::vector<GLfloat> colors;
         std::vector<GLfloat> colDebug;
+        // two per vertex, either empty or as long as vertacies says, vertices added without one get (0, 0)
+        std::vector<GLfloat> uvs;
+        // three per triangle, into vertacies / colors
+        std::vector<GLuint> indices;
+        // bumped whenever the geometry or colors change
+        size_t revision = 0;
+
+        // center and radius of a sphere around every vertex, cached per revision
+        glm::vec4 boundingSphere();
+        // corners of the axis aligned box around every vertex, cached per revision
+        void boundingBox(glm::vec3& min, glm::vec3& max);
+        // true when any vertex color has alpha below 1, cached per revision
+        bool translucent();
+        // fills the cache above for the current revision, for loaders that stored the bounds with the vertices
+        void setBounds(glm::vec4 sphere, glm::vec3 min, glm::vec3 max, bool translucent);
 
+        GLuint vertex(glm::vec3 position, glm::vec4 color);
+        GLuint vertex(glm::vec3 position, glm::vec4 color, glm::vec2 uv);
         void triangle(glm::vec3 vertexPos1, glm::vec3 vertexPos2, glm::vec3 ver3vertexPos3, glm::vec4 color);
         void colorTriangle(glm::vec3 vertexPos1, glm::vec3 vertexPos2, glm::vec3 vertexPos3, glm::vec4 color1, glm::vec4 color2, glm::vec4 color3);
         void rectangle(glm::vec3 position, glm::vec4 rotation, glm::vec2 size, glm::vec4 color);
@@ -233,6 +499,40 @@ namespace Element {
         void bean();
 
         void debug(bool debug);
+
+        // merges vertices that share position and color (meshProcessing.cpp)
+        void weld();
+        // orders triangles for the post-transform vertex cache and overdraw, then vertices by first use
+        void optimize(int cacheSize = 16);
+        // collapses edges by quadric error over position and color until targetTriangles are left or the next
+        // collapse would move the surface more than maxError (fraction of the bounding sphere radius), vertices
+        // on color seams and open borders stay where they are
+        void simplify(size_t targetTriangles, float maxError = FLT_MAX);
+    private:
+        size_t boundsRevision = SIZE_MAX;
+        glm::vec4 boundsSphere;
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        bool boundsTranslucent = false;
+
+        void updateBounds();
+    };
+    // read only view of a whole file through the OS's memory mapping (mappedFile.cpp), pages are read from
+    // disk when they're first touched, data stays null when the file can't be mapped
+    class mappedFile {
+    public:
+        const unsigned char* data = nullptr;
+        size_t size = 0;
+
+        mappedFile(const std::string& path);
+        ~mappedFile();
+        mappedFile(const mappedFile&) = delete;
+        mappedFile& operator=(const mappedFile&) = delete;
+    private:
+        // a file and a file mapping HANDLE on Windows, a descriptor elsewhere
+        void* file = nullptr;
+        void* mapping = nullptr;
+        int descriptor = -1;
     };
     class texture {
     public:
@@ -240,27 +540,199 @@ namespace Element {
         int height;
         int channels;
         std::vector<unsigned char> data;
+        // set by a textureCache hit, the pixels then stay in the mapped file instead of data
+        std::shared_ptr<mappedFile> mapping;
+        size_t mappedOffset = 0;
+        size_t mappedSize = 0;
+        // GL_RGBA8, or a block compressed format from a cooked .etex file, whose data then holds
+        // all levels of its mip chain back to back
+        GLenum format = GL_RGBA8;
+        int levels = 1;
+        // bumped whenever the pixels are replaced
+        size_t revision = 0;
 
+        // a PNG, or a cooked texture (textureContainer.h) when the path ends in .etex
         texture(std::string png_path);
         texture();
+
+        // data, or the mapped pixels when there's a mapping
+        const unsigned char* texels() const;
+        size_t bytes() const;
+    };
+    // decoded textures kept on disk (textureCache.cpp), one entry per source in directory named by a hash of
+    // its path. An entry is used while the source's modification time and size match, or its content hash
+    // when only the time changed, and is mapped rather than read so its pages go straight to the texturePool's
+    // staging PBO. Misses decode the source and write the entry for the next run
+    class textureCache {
+    public:
+        std::string directory;
+        // hits are the warm loads and misses the cold ones, with the time each kind took so far
+        std::atomic<size_t> hits = 0;
+        std::atomic<size_t> misses = 0;
+        std::atomic<uint64_t> hitNanoseconds = 0;
+        std::atomic<uint64_t> missNanoseconds = 0;
+
+        textureCache(std::string directory = "textureCache");
+        // the texture at path, safe to call from several threads
+        texture load(const std::string& path);
+        // hits and misses with their average time in ms
+        void report(std::ostream& out);
+    private:
+        bool read(const std::string& entry, const std::string& path, texture& texture);
+        void write(const std::string& entry, const std::string& path, const texture& texture);
+    };
+    // textures grouped into texture arrays by size and format, so objects with different textures still
+    // share draws, an ID is the array index << 16 | layer and ID 0 is a white texel
+    class texturePool {
+    public:
+        // arrays bound by bind(), the size of the sampler2DArray array in FragmentTextured.txt
+        static constexpr size_t maxArrays = 8;
+        std::vector<std::unique_ptr<GL::textureArray>> arrays;
+        // bytes of pixels staged through the PBO per upload(), three frames worth are mapped at once
+        size_t stagingSize = 16 << 20;
+
+        texturePool();
+        // the texture's ID, its pixels are sent by a later upload(), a new revision gets a new layer and ID
+        GLuint add(texture* texture);
+        // copies waiting textures into the persistently mapped staging PBO until the frame's part of it is full,
+        // the rest waits for the next call, then rebuilds the mip chains of the arrays that got single level layers
+        void upload();
+        // array i to texture unit firstUnit + i
+        void bind(GLuint firstUnit = 0);
+    private:
+        struct entry {
+            GLuint ID;
+            size_t revision;
+        };
+        struct pendingUpload {
+            texture* texture;
+            GLuint ID;
+            size_t revision;
+        };
+        texture white;
+        std::map<texture*, entry> IDs;
+        std::vector<pendingUpload> pending;
+        GL::Buffer::PBO_Unpack<GLubyte> staging;
+    };
+    // decodes PNGs on worker threads (textureLoader.cpp), a texture handed to load() keeps its pixels, the
+    // white default for a new one, until finish() moves the decoded ones in on the GL thread
+    class textureLoader {
+    public:
+        // loads go through it when it's set, it has to outlive the loader
+        textureCache* cache = nullptr;
+
+        // 0 is one thread per hardware thread
+        textureLoader(unsigned threads = 0);
+        ~textureLoader();
+
+        // target has to outlive the load, e.g. a model's texture in modelStorage
+        void load(texture* target, const std::string& path);
+        // moves finished textures into their targets and bumps their revision, returns how many
+        size_t finish();
+        // loads that haven't been through finish() yet
+        size_t pending();
+    private:
+        struct job {
+            texture* target;
+            std::string path;
+        };
+        struct result {
+            texture* target;
+            texture decoded;
+        };
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::deque<job> jobs;
+        std::vector<result> results;
+        size_t loading = 0;
+        bool stopping = false;
+
+        void work();
     };
     class model {
     public:
         mesh mesh;
         texture texture;
+        // coarser versions of mesh, lods[i] is level i + 1
+        std::vector<Element::mesh> lods;
+        // level i + 1 is drawn once the object covers less than lodScreenSize[i] of the screen height
+        std::vector<float> lodScreenSize;
+
+        // level 0 is mesh itself
+        Element::mesh& lod(size_t level);
+        size_t lodLevels() const;
+        // rebuilds mesh and levels - 1 coarser meshes, build() gets a cleared mesh and the detail of the
+        // level (1, 1/2, 1/4 ...), the first switch happens below screenSize and every next one at half of it
+        void buildLODs(const std::function<void(Element::mesh& mesh, float detail)>& build, int levels, float screenSize);
+        // replaces the chain with simplified copies of mesh at half the triangles per level, ends early once a
+        // level no longer gets smaller (meshProcessing.cpp)
+        void generateLODs(int levels, float screenSize, float maxError = FLT_MAX);
     };
 
     namespace Storage {
         class modelStorage {
         public:
             std::map<std::string, model> models;
+
+            // model::generateLODs for every model, spread over threads (0 is one per hardware thread)
+            void generateLODs(int levels, float screenSize, float maxError = FLT_MAX, unsigned threads = 0);
+            // every model's meshes, LOD chain and bounds as a binary model file (meshContainer.h, meshAsset.cpp),
+            // textures aren't part of it. source is stored with them, usually sourceHash() of the models before
+            // they were processed
+            bool save(const std::string& path, uint64_t source = 0);
+            // maps a file written by save() and adds or replaces its models, each stream is one block copy out
+            // of the mapped pages and the stored bounds are taken as they are, false when it can't be used or
+            // was saved with another source
+            bool load(const std::string& path, uint64_t source = 0);
+            // 64 bit FNV-1a over every model's name and level streams plus settings, the processing parameters
+            uint64_t sourceHash(const std::string& settings);
         };
     }
 
     class object {
     public:
-        model* model;
+        model* model = nullptr;
         Transform transform;
+        bool dirty = true;
+
+        void setModel(Element::model* model);
+        void setTransform(const Transform& transform);
+    private:
+        friend class layer;
+        // range inside the layer batch and the state it was built from
+        size_t firstVertex = 0;
+        size_t vertexCount = 0;
+        size_t firstIndex = 0;
+        size_t indexCount = 0;
+        size_t instance = 0;
+        // level of detail picked last frame, kept to hold it while the size sits near a threshold
+        size_t lod = 0;
+        Element::model* batchedModel = nullptr;
+        size_t batchedRevision = 0;
+        Transform batchedTransform;
+    };
+
+    // std140 layout of the Camera uniform block every shader reads
+    struct cameraBlock {
+        static constexpr GLuint binding = 0;
+
+        glm::vec4 cameraRotation;
+        glm::vec3 cameraPosition;
+        float cameraFOV;
+        glm::vec3 cameraSize;
+        float aspectRatio;
+        float nearPlane;
+        float farPlane;
+        glm::vec2 padding;
+        // camera::projection() * camera::view(), for shaders that skip the legacy perspective()
+        glm::mat4 viewProjection;
+    };
+
+    enum class prePassMode {
+        off,
+        on,       // opaque depth first with color writes off, then the shaded pass with GL_LEQUAL and no depth writes
+        automatic // on while the measured overdraw (layer::overdraw) is above layer::prePassThreshold
     };
 
     class camera {
@@ -268,22 +740,309 @@ namespace Element {
         float FOV = 80;
         Transform transform;
         bool depth = true;
+        // only layers rendered with a shaderPermutations can use it, the depth variant has to share the
+        // shading program's vertex stage
+        prePassMode prePass = prePassMode::off;
+        float nearPlane = 0.1f;
+        float farPlane = 1000.0f;
+
+        // world space to camera space, inverse(rotation) * (p - position) / size
+        glm::mat4 view();
+        // clip space matching Vertex.txt's perspective(): +z forward, FOV across x, far plane at near + far
+        glm::mat4 projection(float aspectRatio);
+        // world space planes (normal, distance), a point is inside when dot(normal, p) + distance >= 0
+        std::array<glm::vec4, 6> frustum(float aspectRatio);
+    };
+
+    // bounding spheres as separate x, y, z and radius arrays so cullSpheres can test several per instruction
+    struct sphereList {
+        std::vector<float> x;
+        std::vector<float> y;
+        std::vector<float> z;
+        std::vector<float> radius;
+
+        size_t size() const { return x.size(); }
+        void clear();
+        void push_back(const glm::vec4& sphere);
+    };
+    // visible[i] becomes 1 when sphere i is at least partly inside all planes (culling.cpp)
+    void cullSpheres(const sphereList& spheres, const std::array<glm::vec4, 6>& planes, std::vector<uint8_t>& visible);
+
+    // draws tagged with a 64 bit key, submitting them in key order keeps state changes low (renderQueue.cpp)
+    class renderQueue {
+    public:
+        struct item {
+            uint64_t key;
+            // whatever the caller needs to find the draw again
+            uint32_t index;
+        };
+        std::vector<item> items;
+        static constexpr uint64_t translucentBit = 1ull << 55;
+
+        // layer (8 bits), translucent (1), then for opaque draws program (10), material (15) and depth front to back (30),
+        // translucent draws put depth back to front before program and material so blending stays correct
+        static uint64_t key(uint8_t layer, bool translucent, uint16_t program, uint16_t material, float depth);
+        void clear() { items.clear(); }
+        void push(uint64_t key, uint32_t index) { items.push_back({ key, index }); }
+        // stable LSD radix sort, 8 bits per pass, passes where every key has the same byte are skipped
+        void sort();
+    private:
+        static constexpr uint64_t depthMask = (1ull << 30) - 1;
+        static constexpr uint16_t programMask = (1 << 10) - 1;
+        static constexpr uint16_t materialMask = (1 << 15) - 1;
+
+        std::vector<item> scratch;
+    };
+
+    // interleaved vertex of vertexFormat::full
+    struct vertex {
+        glm::vec3 position;
+        glm::vec4 color;
+    };
+    // interleaved vertex of vertexFormat::compact, position is quantized to the mesh bounds and w is padding
+    struct compactVertex {
+        glm::u16vec4 position;
+        glm::u8vec4 color;
+    };
+    // per object record of objectVBO, the rows of the 3x4 model matrix built by modelMatrices()
+    struct objectRecord {
+        glm::vec4 row0;
+        glm::vec4 row1;
+        glm::vec4 row2;
+    };
+    static_assert(sizeof(objectRecord) == 12 * sizeof(GLfloat), "objectVBO records are 12 tightly packed floats");
+    // one level of an object's LOD chain as Cull.txt reads it (std430)
+    struct cullLevel {
+        // lodScreenSize of the level, the next one is drawn below it, 0 for the last level
+        float screenSize;
+        GLuint count;
+        GLuint firstIndex;
+        GLuint padding;
+    };
+
+    // transforms as separate arrays per component so modelMatrices can convert several per instruction
+    struct transformList {
+        std::vector<float> px, py, pz;
+        std::vector<float> rx, ry, rz, rw;
+        std::vector<float> sx, sy, sz;
+
+        size_t size() const { return px.size(); }
+        void clear();
+        void resize(size_t count);
+        void set(size_t i, const Transform& transform);
+        void push_back(const Transform& transform);
     };
+    // writes 12 floats per transform, the rows of R(rotation) * diag(size) with position as 4th column (matrices.cpp)
+    void modelMatrices(const transformList& transforms, GLfloat* out);
 
+    enum class renderMode {
+        batched,   // every object gets its own copy of the model vertices
+        instanced, // models are stored once, objectVBO holds one matrix per object (divisor 1)
+        indirect   // instanced layout submitted with one glMultiDrawElementsIndirect from the DIB
+    };
+    enum class vertexFormat {
+        full,   // float positions and colors, vertexVBO
+        compact // 16 bit positions quantized to the mesh bounds and RGBA8 colors, compactVBO
+    };
+    enum class blendMode {
+        sorted,  // translucent draws are queued back to front and blended into the window
+        weighted // weighted blended OIT: translucent draws go unsorted into accumulation / revealage targets, then get composited
+    };
+    // bits of layer::shaderFeatures(), a shaderPermutations for a layer lists its features in this order
+    namespace shaderFeature {
+        constexpr uint32_t textured = 1 << 0;    // TEXTURED, texVBO / texIDVBO and the texturePool's arrays
+        constexpr uint32_t vertexColor = 1 << 1; // VERTEX_COLOR, the color attribute
+        // pass bits, added by the layer to the variant it shades with
+        constexpr uint32_t depthOnly = 1 << 2;   // DEPTH_ONLY, the depth pre-pass
+        constexpr uint32_t oit = 1 << 3;         // OIT, accumulation / revealage of blendMode::weighted
+    }
+    // instanced and indirect layers also accept a streaming objectVBO (buffer::stream), every
+    // frame's matrices are then written straight into the mapped partition. Batched layers don't draw with one
     class layer {
     public:
-        GL::Buffer::VBO<GLfloat> posVBO;
-        GL::Buffer::VBO<GLfloat> colVBO;
+        // vertices of the layer's format, only one of them is filled
+        GL::Buffer::VBO<vertex> vertexVBO;
+        GL::Buffer::VBO<compactVertex> compactVBO;
         GL::Buffer::VBO<GLfloat> objectVBO;
+        // with textured set, two UVs and the texturePool ID per vertex next to the vertices above
         GL::Buffer::VBO<GLfloat> texVBO;
         GL::Buffer::VBO<GLuint> texIDVBO;
         GL::Buffer::EBO EBO;
+        GL::Buffer::DIB<GL::DrawElementsIndirectCommand> DIB;
+        // GPU culling inputs, one entry per object, opaque objects first
+        GL::Buffer::SSBO<glm::vec4> boundsSSBO;
+        GL::Buffer::SSBO<GL::DrawElementsIndirectCommand> commandSSBO;
+        // every object's LOD chain, first entry in levelSSBO and level count per object, and the level each
+        // object was drawn with last frame, which Cull.txt keeps for the hysteresis
+        GL::Buffer::SSBO<cullLevel> levelSSBO;
+        GL::Buffer::SSBO<glm::uvec2> levelRangeSSBO;
+        GL::Buffer::SSBO<GLuint> lodSSBO;
+        // visible opaque and visible translucent draws
+        GL::Buffer::ACBO<GLuint> visibleACBO;
+        // camera block, bound to cameraBlock::binding for every program while the layer draws
+        GL::Buffer::UBO<cameraBlock> cameraUBO;
 
         std::map<std::string, object> objects;
         camera camera;
+        // can change between frames, render() sets the divisor of objectVBO's attributes to match it
+        renderMode mode = renderMode::batched;
+        vertexFormat format = vertexFormat::full;
+        // fills texVBO / texIDVBO from the meshes' uvs and the models' textures, and binds textures
+        // for FragmentTextured.txt
+        bool textured = false;
+        texturePool textures;
+        // off when every mesh is white, the program variant then skips the color attribute
+        bool vertexColors = true;
+        // drawn with instead of render()'s program while that one is still building (shaderProgram::build),
+        // without it those frames draw nothing. The optional programs below are skipped until they're ready
+        GL::shaderProgram* fallbackProgram = nullptr;
+        // compute program (Cull.txt) that frustum culls objects and picks their level of detail on the GPU in
+        // indirect mode
+        GL::shaderProgram* cullProgram = nullptr;
+        // blendMode::weighted draws translucent objects with the OIT variant of render()'s shaderPermutations
+        // and resolves them with compositeProgram (CompositeVertex.txt with Composite.txt), without either
+        // translucent draws stay sorted
+        blendMode blending = blendMode::sorted;
+        GL::shaderProgram* compositeProgram = nullptr;
+        // opaque fragments passing the depth test in the first opaque pass per window pixel, measured with
+        // GL_SAMPLES_PASSED a few frames behind
+        float overdraw = 0;
+        float prePassThreshold = 1.5f;
+        // CPU frustum culling of the other modes, visibleObjects is what passed it last render()
+        bool frustumCulling = true;
+        size_t visibleObjects = 0;
+        // per object level of detail from the projected size, it only changes once the size is lodHysteresis
+        // past a threshold, GPU culled draws always use level 0
+        bool levelOfDetail = true;
+        float lodHysteresis = 0.1f;
+        // triangles in the draws built on the CPU last render()
+        size_t submittedTriangles = 0;
+        // bytes sent to the GPU by the last render()
+        size_t uploadedBytes = 0;
 
         layer(GL::VAO* VAO);
         ~layer();
         void render(GL::window* window, GL::shaderProgram* shader, GL::VAO* VAO);
+        // render() with the variant of shaders that matches shaderFeatures(), the depth pre-pass and weighted
+        // blending take the DEPTH_ONLY and OIT variants of the same stages
+        void render(GL::window* window, GL::shaderPermutations* shaders, GL::VAO* VAO);
+        // shaderFeature bits of what the layer feeds its program
+        uint32_t shaderFeatures() const;
+    private:
+        struct modelRange {
+            size_t firstVertex = 0;
+            size_t vertexCount = 0;
+            size_t firstIndex = 0;
+            size_t indexCount = 0;
+            size_t firstInstance = 0;
+            size_t instanceCount = 0;
+            size_t revision = 0;
+        };
+        renderMode builtMode = renderMode::batched;
+        vertexFormat builtFormat = vertexFormat::full;
+        bool builtTextured = false;
+        size_t batchVertices = 0;
+        size_t batchIndices = 0;
+        size_t batchInstances = 0;
+        std::map<Element::model*, modelRange> modelRanges;
+        // materialKey() of every model queued this frame
+        std::map<const Element::model*, uint16_t> materialIDs;
+        // bumped whenever the instanced layout or a model in it changes
+        size_t layoutRevision = 0;
+        size_t commandRevision = 0;
+        size_t cullRevision = 0;
+        // commandSSBO entries before this one are opaque
+        size_t culledOpaque = 0;
+        // first instance of this frame's partition when objectVBO is streaming
+        size_t instanceBase = 0;
+        // CPU culling results, objectVisible and objectDepth follow the order of objects
+        sphereList objectSpheres;
+        std::vector<uint8_t> objectVisible;
+        std::vector<float> objectDepth;
+        std::vector<object*> objectSlots;
+        std::vector<uint8_t> instanceVisible;
+        std::vector<float> instanceDepth;
+        std::vector<uint8_t> instanceLOD;
+        // submission order of the draws below
+        renderQueue queue;
+        std::vector<GL::DrawElementsIndirectCommand> queuedDraws;
+        // draws before this index are opaque, the rest translucent
+        size_t opaqueDraws = 0;
+        // accumulation (RGBA16F) and revealage (R16F) targets of blendMode::weighted
+        GL::framebuffer oitTarget;
+        // blendMode::weighted is in effect this frame, the translucent draws then aren't sorted
+        bool weightedBlending = false;
+        GL::query overdrawQuery;
+        bool overdrawPending = false;
+        bool prePassActive = false;
+        std::vector<GL::DrawElementsIndirectCommand> draws;
+        std::vector<GLsizei> batchCounts;
+        std::vector<const void*> batchOffsets;
+        // objects whose matrices are rebuilt this frame, converted together by modelMatrices()
+        transformList pendingTransforms;
+        std::vector<object*> pendingObjects;
+        std::vector<GLfloat> pendingMatrices;
+        // Cull.txt handles, looked up again when cullProgram changes
+        GLuint cullProgramID = 0;
+        GL::uniform<glm::vec4> cullFrustum;
+        GL::uniform<GLuint> cullObjectCount;
+        GL::uniform<GLuint> cullInstanceOffset;
+        GL::uniform<GLuint> cullTranslucentFirst;
+        GL::uniform<glm::vec3> cullCameraPosition;
+        GL::uniform<glm::vec3> cullCameraForward;
+        GL::uniform<GLfloat> cullTanY;
+        GL::uniform<GLfloat> cullNearPlane;
+        GL::uniform<GLfloat> cullHysteresis;
+        GL::uniform<GLuint> cullLevelLimit;
+
+        // false when objectVBO is streaming, batched layers need it loaded
+        bool buildBatch();
+        bool buildInstances();
+        void writeVertices(mesh& mesh, size_t first, Element::mesh& box);
+        void writeChain(model& model, size_t firstVertex, GLuint* indices, GLuint indexOffset);
+        Transform objectTransform(const Transform& transform, mesh& mesh);
+        glm::vec4 cullSphere(mesh& mesh);
+        void cullObjects(float aspectRatio);
+        void selectLODs(float aspectRatio);
+        uint16_t materialKey(const Element::model* model);
+        void buildBatchDraws(GLuint program);
+        void buildDraws(GLuint program);
+        void uploadDraws();
+        size_t queuedDrawCount();
+        void drawQueued(size_t first, size_t end);
+        // draws[first, end) one call each, for draws that aren't in the DIB
+        void drawDirect(size_t first, size_t end);
+        // draw submits the translucent draws
+        void drawWeighted(GL::window* window, GL::VAO* VAO, GL::shaderProgram* oit, const std::function<void()>& draw);
+        bool usePrePass(GL::window* window);
+        // draw submits the opaque draws, once per pass
+        void drawOpaque(GL::window* window, GL::shaderProgram* shader, GL::shaderProgram* depth, const std::function<void()>& draw);
+        // render() with the variants of shader for the other passes when it comes from one
+        void draw(GL::window* window, GL::shaderProgram* shader, GL::shaderPermutations* variants, GL::VAO* VAO);
+        void cull(float aspectRatio);
+        void drawCulled(bool translucent);
+    };
+}
+
+namespace GL {
+    template<> struct vertexLayout<Element::vertex> {
+        static constexpr std::array<vertexAttribute, 2> attributes = {
+            attribute<glm::vec3>(0, offsetof(Element::vertex, position)),
+            attribute<glm::vec4>(1, offsetof(Element::vertex, color))
+        };
     };
-}
\ No newline at end of file
+    template<> struct vertexLayout<Element::compactVertex> {
+        static constexpr std::array<vertexAttribute, 2> attributes = {
+            // only xyz are read, w keeps the vertex 4 byte aligned
+            attribute<glm::u16vec3>(0, offsetof(Element::compactVertex, position), attribFormat::normalized),
+            attribute<glm::u8vec4>(1, offsetof(Element::compactVertex, color), attribFormat::normalized)
+        };
+    };
+    template<> struct vertexLayout<Element::objectRecord> {
+        static constexpr std::array<vertexAttribute, 3> attributes = {
+            attribute<glm::vec4>(2, offsetof(Element::objectRecord, row0)),
+            attribute<glm::vec4>(3, offsetof(Element::objectRecord, row1)),
+            attribute<glm::vec4>(4, offsetof(Element::objectRecord, row2))
+        };
+    };
+}
@@ -4,48 +4,190 @@
 GL::window window(800, 600, false, "image test");
 GL::VAO VAO;
 
-int main() {
+// renders the layer with each program for a fixed number of frames, or until the window closes, and prints
+// the average GPU time per rendered frame
+void benchmark(Element::layer& layer, std::vector<std::pair<std::string, GL::shaderProgram*>> programs) {
+    const int frames = 500;
+
+    size_t triangles = 0;
+    for (auto& [key, object] : layer.objects) {
+        if (object.model)
+            triangles += (object.model->mesh.indices.empty() ? object.model->mesh.vertacies.size() / 3 : object.model->mesh.indices.size()) / 3;
+    }
+
+    // the timings only mean something once every program is linked
+    for (auto& [name, program] : programs) {
+        while (program->status == GL::programStatus::building && !program->ready())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // a query per frame, read once the loop is done so waiting on a result never stalls the frames being timed
+    std::vector<std::unique_ptr<GL::query>> timers;
+    for (int frame = 0; frame < frames; frame++)
+        timers.push_back(std::make_unique<GL::query>(GL_TIME_ELAPSED));
+    for (auto& [name, program] : programs) {
+        int rendered = 0;
+        for (; rendered < frames && !glfwWindowShouldClose(window.ID); rendered++) {
+            window.setView(glm::vec2(0, 0), glm::vec2(0, 0), glm::vec2(0, 0), glm::vec2(1, 1));
+            glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            timers[rendered]->begin();
+            layer.render(&window, program, &VAO);
+            timers[rendered]->end();
+
+            glfwPollEvents();
+            glfwSwapBuffers(window.ID);
+        }
+        if (!rendered)
+            return;
+        GLuint64 nanoseconds = 0;
+        for (int frame = 0; frame < rendered; frame++)
+            nanoseconds += timers[frame]->result();
+        double milliseconds = nanoseconds / 1e6 / rendered;
+        std::cout << name << ": " << milliseconds << " ms/frame, "
+            << triangles / (milliseconds * 1e3) << " Mtriangles/s (" << triangles << " triangles)" << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
     Element::Storage::modelStorage modelStorage;
 
     VAO.bind();
     Element::layer layer(&VAO);
     VAO.unbind();
 
-    VAO.configure(&layer.posVBO, 0, 3, 3, 0);
-    VAO.configure(&layer.colVBO, 1, 4, 4, 0);
-    VAO.configure(&layer.objectVBO, 2, 3, 10, 0);
-    VAO.configure(&layer.objectVBO, 3, 4, 10, 3);
-    VAO.configure(&layer.objectVBO, 4, 3, 10, 7);
-
-    GL::shaderProgram shader;
-    shader.addShader(GL_VERTEX_SHADER, "Vertex.txt");
-    shader.addShader(GL_FRAGMENT_SHADER, "Fragment.txt");
-    shader.addShader(GL_GEOMETRY_SHADER, "Geometry.txt");
-    shader.compile();
-
+    layer.format = Element::vertexFormat::compact;
+    VAO.configure(&layer.compactVBO);
+    layer.mode = Element::renderMode::indirect;
+    layer.objectVBO.stream(1024 * 12);
+    VAO.configure<Element::objectRecord>(&layer.objectVBO, 1);
+    layer.textured = true;
+    VAO.configure(&layer.texVBO, 5, 2, 2, 0);
+    VAO.configure(&layer.texIDVBO, 6, 1, 1, 0, 0, GL::attribFormat::integer);
+
+    // linked programs are cached as driver binaries, a warm start only compiles what changed, and every
+    // program but the fallback builds while the scene loads and the first frames draw
+    auto programsStart = std::chrono::steady_clock::now();
+    GL::shaderProgram::binaryCache = "shaderCache";
+
+    // legacy three stage program, kept for the benchmark
+    GL::shaderProgram legacyShader;
+    legacyShader.addShader(GL_VERTEX_SHADER, "Vertex.txt");
+    legacyShader.addShader(GL_FRAGMENT_SHADER, "Fragment.txt");
+    legacyShader.addShader(GL_GEOMETRY_SHADER, "Geometry.txt");
+    legacyShader.build();
+
+    // one variant per layer::shaderFeatures() combination, the layer picks its own in render()
+    GL::shaderPermutations shaders({ "TEXTURED", "VERTEX_COLOR", "DEPTH_ONLY", "OIT" });
+    shaders.addShader(GL_VERTEX_SHADER, "VertexMatrix.txt");
+    shaders.addShader(GL_FRAGMENT_SHADER, "FragmentTextured.txt");
+    GL::shaderProgram& shader = *shaders.get(layer.shaderFeatures());
+
+    GL::shaderProgram cull;
+    cull.addShader(GL_COMPUTE_SHADER, "Cull.txt");
+    cull.build();
+    layer.cullProgram = &cull;
+
+    // depth pre-pass with the DEPTH_ONLY variant of shaders, turned on when the measured overdraw gets high
+    layer.camera.prePass = Element::prePassMode::automatic;
+
+    // weighted blended transparency for the translucent circle, the OIT variant is asked for up front so it
+    // builds with the others
+    GL::shaderProgram& oit = *shaders.get(layer.shaderFeatures() | Element::shaderFeature::oit);
+
+    GL::shaderProgram composite;
+    composite.addShader(GL_VERTEX_SHADER, "CompositeVertex.txt");
+    composite.addShader(GL_FRAGMENT_SHADER, "Composite.txt");
+    composite.build();
+
+    // vertex colors only, drawn with until shader is ready
+    GL::shaderProgram fallback;
+    fallback.addShader(GL_VERTEX_SHADER, "VertexMatrix.txt");
+    fallback.addShader(GL_FRAGMENT_SHADER, "Fragment.txt");
+    fallback.compile();
+    layer.fallbackProgram = &fallback;
+    std::vector<GL::shaderProgram*> programs = { &legacyShader, &shader, &cull, &oit, &composite };
+    bool programsReported = false;
+
+    layer.blending = Element::blendMode::weighted;
+    layer.compositeProgram = &composite;
+
+    // the models below are cheap to generate, optimizing and simplifying them is most of the startup time, so
+    // their processed versions come from models.emesh while it was saved from the same meshes and settings
+    auto modelsStart = std::chrono::steady_clock::now();
     modelStorage.models["cubes"].mesh.cube(glm::vec3(-5, -5, 20), glm::vec4(0, 0, 0, 0), glm::vec3(10, 10, 10), glm::vec4(1, 0, 0, 1));
     modelStorage.models["cubes"].mesh.cube(glm::vec3(20, -5, -5), glm::vec4(0, 0, 0, 0), glm::vec3(10, 10, 10), glm::vec4(0, 1, 0, 1));
     modelStorage.models["cubes"].mesh.cube(glm::vec3(-5, 20, -5), glm::vec4(0, 0, 0, 0), glm::vec3(10, 10, 10), glm::vec4(0, 0, 1, 1));
     modelStorage.models["test"].mesh.circle(glm::vec3(20, 20, 20), glm::vec4(0, 0, 0, 0), 5, 20, glm::vec4(1, 1, 1, 0.5));
     modelStorage.models["cubes"].mesh.sphere(glm::vec3(-20, -20, -20), 5, 20, glm::vec3(1, 1, 1), glm::vec4(0, 0, 1, 1));
+    const int lodLevels = 4;
+    const float lodScreenSize = 0.25f, lodError = 0.05f;
+    uint64_t modelSource = modelStorage.sourceHash("optimize, generateLODs " + std::to_string(lodLevels) + " " +
+        std::to_string(lodScreenSize) + " " + std::to_string(lodError));
+    bool modelsLoaded = modelStorage.load("models.emesh", modelSource);
+    if (!modelsLoaded) {
+        for (auto& [name, model] : modelStorage.models)
+            model.mesh.optimize();
+        // simplified chains for everything loaded so far, one model per thread
+        modelStorage.generateLODs(lodLevels, lodScreenSize, lodError);
+        modelStorage.save("models.emesh", modelSource);
+    }
+    std::cout << "Models " << (modelsLoaded ? "loaded" : "built") << " in "
+        << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - modelsStart).count() << " ms" << std::endl;
+
+    // a row of spheres running away from the camera, each level has half the segments of the one before
+    modelStorage.models["planet"].buildLODs([](Element::mesh& mesh, float detail) {
+        mesh.sphere(glm::vec3(0), 5, std::max(48 * detail, 4.0f), glm::vec3(1, 1, 1), glm::vec4(1, 0.5, 0, 1));
+        mesh.optimize();
+    }, 5, 0.25f);
+    // checkerboard, the other models keep the white default and still draw in the same batch
+    Element::texture& checker = modelStorage.models["planet"].texture;
+    checker.width = 64;
+    checker.height = 64;
+    checker.data.resize(64 * 64 * 4);
+    for (int i = 0; i < 64 * 64; i++) {
+        unsigned char value = ((i % 64 / 8 + i / 64 / 8) % 2) ? 255 : 96;
+        std::fill(checker.data.begin() + i * 4, checker.data.begin() + i * 4 + 3, value);
+        checker.data[i * 4 + 3] = 255;
+    }
+    // a PNG given on the command line replaces the checkerboard once a worker has decoded it, or mapped
+    // it from the texture cache on later runs
+    Element::textureCache textureCache;
+    Element::textureLoader textureLoader;
+    textureLoader.cache = &textureCache;
+    if (argc > 1 && std::string(argv[1]) != "--benchmark")
+        textureLoader.load(&checker, argv[1]);
+    for (int i = 0; i < 20; i++) {
+        Element::object& object = layer.objects["planet" + std::to_string(i)];
+        object.model = &modelStorage.models["planet"];
+        object.transform.position = glm::vec3(-40, 0, 20 + i * 40);
+    }
 
     layer.objects["cubes"].model = &modelStorage.models["cubes"];
     layer.objects["test"].model = &modelStorage.models["test"];
 
     modelStorage.models["cubes"].mesh.debug(true);
 
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+        // a grid of copies in front of the camera, nothing culled so both programs see every triangle
+        for (int i = 0; i < 1000; i++) {
+            Element::object& object = layer.objects["benchmark" + std::to_string(i)];
+            object.model = &modelStorage.models["cubes"];
+            object.transform.position = glm::vec3((i % 10 - 5) * 60, (i / 10 % 10 - 5) * 60, 100 + i / 100 * 60);
+        }
+        layer.cullProgram = nullptr;
+        layer.frustumCulling = false;
+        layer.levelOfDetail = false;
+        benchmark(layer, { { "Vertex + Geometry", &legacyShader }, { "VertexMatrix", &shader } });
+        return 0;
+    }
+
     glm::vec2 lastCursor;
     window.getMouse(&lastCursor);
 
     float c = 0;
     while (!glfwWindowShouldClose(window.ID)) {
-        bool validQuat = (layer.camera.transform.rotation.x || layer.camera.transform.rotation.y || layer.camera.transform.rotation.z);
-        glm::quat camera = glm::angleAxis(
-            glm::radians((validQuat) ? layer.camera.transform.rotation.w : 0),
-            glm::vec3(
-                (validQuat) ? layer.camera.transform.rotation.x : 1,
-                layer.camera.transform.rotation.y,
-                layer.camera.transform.rotation.z));
+        glm::quat camera = layer.camera.transform.orientation();
         glm::vec3 forward = glm::rotate(camera, glm::vec3(0, 0, 1));
         glm::vec3 right = glm::rotate(camera, glm::vec3(1, 0, 0));
         glm::vec3 up = glm::rotate(camera, glm::vec3(0, 1, 0));
@@ -78,14 +220,6 @@ int main() {
         if (glfwGetMouseButton(window.ID, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
             const float sensitivity = 0.5;
 
-            bool validQuat = (layer.camera.transform.rotation.x || layer.camera.transform.rotation.y || layer.camera.transform.rotation.z);
-
-            glm::quat camera = glm::angleAxis(
-                glm::radians((validQuat) ? layer.camera.transform.rotation.w : 0),
-                glm::vec3(
-                    (validQuat) ? layer.camera.transform.rotation.x : 1, 
-                    layer.camera.transform.rotation.y,
-                    layer.camera.transform.rotation.z));
             glm::quat rotX = glm::angleAxis(glm::radians(deltaCursor.x * sensitivity), glm::vec3(0, 1, 0));
             glm::quat rotY = glm::angleAxis(glm::radians(deltaCursor.y * sensitivity), glm::vec3(1, 0, 0));
 
@@ -99,10 +233,17 @@ int main() {
             layer.camera.transform.rotation = glm::vec4(glm::axis(camera), glm::degrees(glm::angle(camera)));
         }
 
+        if (textureLoader.finish() && !textureLoader.pending())
+            textureCache.report(std::cout);
+        if (!programsReported && std::all_of(programs.begin(), programs.end(), [](GL::shaderProgram* program) { return program->ready() || program->status == GL::programStatus::failed; })) {
+            std::cout << "Programs ready in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - programsStart).count()
+                << " ms, " << GL::shaderProgram::binaryHits << " from the binary cache, " << GL::shaderProgram::binaryMisses << " compiled" << std::endl;
+            programsReported = true;
+        }
         window.setView(glm::vec2(0, 0), glm::vec2(0, 0), glm::vec2(0, 0), glm::vec2(1, 1));
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        layer.render(&window, &shader, &VAO);
+        layer.render(&window, &shaders, &VAO);
 
         glfwPollEvents();
         glfwSwapBuffers(window.ID);
@@ -0,0 +1,62 @@
+#include "framework.h"
+#include "Include.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Element {
+	// mappedFile --
+	mappedFile::mappedFile(const std::string& path) {
+#if defined(_WIN32)
+		HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (handle == INVALID_HANDLE_VALUE)
+			return;
+		file = handle;
+		LARGE_INTEGER length;
+		// an empty file can't be mapped, it's reported as unmappable like a missing one
+		if (!GetFileSizeEx(handle, &length) || length.QuadPart == 0)
+			return;
+		mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping)
+			return;
+		data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (data)
+			size = (size_t)length.QuadPart;
+#else
+		descriptor = open(path.c_str(), O_RDONLY);
+		if (descriptor < 0)
+			return;
+		struct stat status;
+		if (fstat(descriptor, &status) != 0 || status.st_size == 0)
+			return;
+		void* view = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		if (view == MAP_FAILED)
+			return;
+		data = (const unsigned char*)view;
+		size = (size_t)status.st_size;
+#endif
+	}
+	mappedFile::~mappedFile() {
+#if defined(_WIN32)
+		if (data)
+			UnmapViewOfFile(data);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file)
+			CloseHandle(file);
+#else
+		if (data)
+			munmap((void*)data, size);
+		if (descriptor >= 0)
+			close(descriptor);
+#endif
+	}
+}
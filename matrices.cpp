@@ -0,0 +1,145 @@
+#include "framework.h"
+#include "Include.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MATRICES_SSE2
+#endif
+
+namespace Element {
+	namespace {
+		// 3x4 rows of a single transform, the same math as the SSE2 path below
+		void modelMatrix(const transformList& transforms, size_t i, GLfloat* out) {
+			Transform transform;
+			transform.position = glm::vec3(transforms.px[i], transforms.py[i], transforms.pz[i]);
+			transform.rotation = glm::vec4(transforms.rx[i], transforms.ry[i], transforms.rz[i], transforms.rw[i]);
+			transform.size = glm::vec3(transforms.sx[i], transforms.sy[i], transforms.sz[i]);
+			glm::mat3 rotation = glm::mat3_cast(transform.orientation());
+			for (int row = 0; row < 3; row++) {
+				out[row * 4] = rotation[0][row] * transform.size.x;
+				out[row * 4 + 1] = rotation[1][row] * transform.size.y;
+				out[row * 4 + 2] = rotation[2][row] * transform.size.z;
+				out[row * 4 + 3] = transform.position[row];
+			}
+		}
+
+#if defined(MATRICES_SSE2)
+		// sine and cosine of 4 angles at once, Cody-Waite reduction to +-pi/4 and the cephes sinf/cosf polynomials
+		void sincos(__m128 x, __m128& sine, __m128& cosine) {
+			__m128i quadrant = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.63661977236f)));
+			__m128 j = _mm_cvtepi32_ps(quadrant);
+			x = _mm_sub_ps(x, _mm_mul_ps(j, _mm_set1_ps(1.5703125f)));
+			x = _mm_sub_ps(x, _mm_mul_ps(j, _mm_set1_ps(4.837512969970703125e-4f)));
+			x = _mm_sub_ps(x, _mm_mul_ps(j, _mm_set1_ps(7.54978995489188216e-8f)));
+
+			__m128 x2 = _mm_mul_ps(x, x);
+			__m128 s = _mm_add_ps(_mm_mul_ps(x2, _mm_set1_ps(-1.9515295891e-4f)), _mm_set1_ps(8.3321608736e-3f));
+			s = _mm_add_ps(_mm_mul_ps(s, x2), _mm_set1_ps(-1.6666654611e-1f));
+			s = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(s, x2), x), x);
+			__m128 c = _mm_add_ps(_mm_mul_ps(x2, _mm_set1_ps(2.443315711809948e-5f)), _mm_set1_ps(-1.388731625493765e-3f));
+			c = _mm_add_ps(_mm_mul_ps(c, x2), _mm_set1_ps(4.166664568298827e-2f));
+			c = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(c, x2), x2), _mm_sub_ps(_mm_set1_ps(1), _mm_mul_ps(x2, _mm_set1_ps(0.5f))));
+
+			// odd quadrants swap sine and cosine, bit 1 of the quadrant (of quadrant + 1 for cosine) flips the sign
+			__m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+			__m128 sineSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(2)), 30));
+			__m128 cosineSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+			sine = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, c), _mm_andnot_ps(swap, s)), sineSign);
+			cosine = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, s), _mm_andnot_ps(swap, c)), cosineSign);
+		}
+#endif
+	}
+
+	// transformList --
+	void transformList::clear() {
+		resize(0);
+	}
+	void transformList::resize(size_t count) {
+		for (std::vector<float>* component : { &px, &py, &pz, &rx, &ry, &rz, &rw, &sx, &sy, &sz })
+			component->resize(count);
+	}
+	void transformList::set(size_t i, const Transform& transform) {
+		px[i] = transform.position.x;
+		py[i] = transform.position.y;
+		pz[i] = transform.position.z;
+		rx[i] = transform.rotation.x;
+		ry[i] = transform.rotation.y;
+		rz[i] = transform.rotation.z;
+		rw[i] = transform.rotation.w;
+		sx[i] = transform.size.x;
+		sy[i] = transform.size.y;
+		sz[i] = transform.size.z;
+	}
+	void transformList::push_back(const Transform& transform) {
+		resize(size() + 1);
+		set(size() - 1, transform);
+	}
+
+	void modelMatrices(const transformList& transforms, GLfloat* out) {
+		size_t count = transforms.size();
+		size_t i = 0;
+#if defined(MATRICES_SSE2)
+		__m128 zero = _mm_setzero_ps();
+		__m128 one = _mm_set1_ps(1);
+		__m128 two = _mm_set1_ps(2);
+		for (; i + 4 <= count; i += 4, out += 48) {
+			__m128 ax = _mm_loadu_ps(transforms.rx.data() + i);
+			__m128 ay = _mm_loadu_ps(transforms.ry.data() + i);
+			__m128 az = _mm_loadu_ps(transforms.rz.data() + i);
+			__m128 angle = _mm_loadu_ps(transforms.rw.data() + i);
+
+			// Transform::orientation(): the axis length divides the angle as well, a zero axis is no rotation
+			__m128 norm = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, ax), _mm_mul_ps(ay, ay)), _mm_mul_ps(az, az)));
+			__m128 valid = _mm_cmpgt_ps(norm, zero);
+			__m128 inverse = _mm_and_ps(valid, _mm_div_ps(one, _mm_or_ps(norm, _mm_andnot_ps(valid, one))));
+			__m128 halfAngle = _mm_mul_ps(_mm_mul_ps(angle, inverse), _mm_set1_ps(0.00872664626f));
+			__m128 sine, cosine;
+			sincos(halfAngle, sine, cosine);
+			cosine = _mm_or_ps(_mm_and_ps(valid, cosine), _mm_andnot_ps(valid, one));
+
+			__m128 scale = _mm_mul_ps(sine, inverse);
+			__m128 x = _mm_mul_ps(ax, scale);
+			__m128 y = _mm_mul_ps(ay, scale);
+			__m128 z = _mm_mul_ps(az, scale);
+			__m128 w = cosine;
+
+			__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+			__m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+			__m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+			__m128 sx = _mm_loadu_ps(transforms.sx.data() + i);
+			__m128 sy = _mm_loadu_ps(transforms.sy.data() + i);
+			__m128 sz = _mm_loadu_ps(transforms.sz.data() + i);
+
+			// element [row][column] for 4 objects, the rotation columns scaled by size and the position last
+			__m128 m[3][4] = {
+				{
+					_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx),
+					_mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy),
+					_mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz),
+					_mm_loadu_ps(transforms.px.data() + i)
+				},
+				{
+					_mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx),
+					_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy),
+					_mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz),
+					_mm_loadu_ps(transforms.py.data() + i)
+				},
+				{
+					_mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx),
+					_mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy),
+					_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz),
+					_mm_loadu_ps(transforms.pz.data() + i)
+				}
+			};
+			// transposing a row turns 4 objects' elements into one object's row
+			for (int row = 0; row < 3; row++) {
+				_MM_TRANSPOSE4_PS(m[row][0], m[row][1], m[row][2], m[row][3]);
+				for (int object = 0; object < 4; object++)
+					_mm_storeu_ps(out + object * 12 + row * 4, m[row][object]);
+			}
+		}
+#endif
+		for (; i < count; i++, out += 12)
+			modelMatrix(transforms, i, out);
+	}
+}
@@ -0,0 +1,220 @@
+#include "framework.h"
+#include "Include.h"
+#include "meshContainer.h"
+
+namespace Element {
+	namespace {
+		uint64_t align16(uint64_t offset) {
+			return (offset + 15) & ~(uint64_t)15;
+		}
+		// true when count elements of size bytes at offset are inside the file
+		bool inside(const mappedFile& file, uint64_t offset, uint64_t count, uint64_t size) {
+			return offset <= file.size && count <= (file.size - offset) / size;
+		}
+		// 64 bit FNV-1a
+		uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+			const unsigned char* bytes = (const unsigned char*)data;
+			for (size_t i = 0; i < size; i++) {
+				hash ^= bytes[i];
+				hash *= 1099511628211ull;
+			}
+			return hash;
+		}
+	}
+
+	namespace Storage {
+		// modelStorage --
+		uint64_t modelStorage::sourceHash(const std::string& settings) {
+			uint64_t hash = hashBytes(settings.data(), settings.size());
+			for (auto& [name, model] : models) {
+				// the sizes go in too, so streams can't shift from one into the next with the same bytes
+				uint64_t levels = model.lodLevels();
+				hash = hashBytes(name.data(), name.size() + 1, hash);
+				hash = hashBytes(&levels, sizeof(levels), hash);
+				for (size_t level = 0; level < model.lodLevels(); level++) {
+					Element::mesh& mesh = model.lod(level);
+					uint64_t sizes[4] = { mesh.vertacies.size(), mesh.colors.size(), mesh.uvs.size(), mesh.indices.size() };
+					hash = hashBytes(sizes, sizeof(sizes), hash);
+					hash = hashBytes(mesh.vertacies.data(), mesh.vertacies.size() * sizeof(GLfloat), hash);
+					hash = hashBytes(mesh.colors.data(), mesh.colors.size() * sizeof(GLfloat), hash);
+					hash = hashBytes(mesh.uvs.data(), mesh.uvs.size() * sizeof(GLfloat), hash);
+					hash = hashBytes(mesh.indices.data(), mesh.indices.size() * sizeof(GLuint), hash);
+				}
+				hash = hashBytes(model.lodScreenSize.data(), model.lodScreenSize.size() * sizeof(float), hash);
+			}
+			return hash;
+		}
+		bool modelStorage::save(const std::string& path, uint64_t source) {
+			// tables and strings first, the streams follow them in the order they're listed here
+			std::vector<Cooked::meshModel> modelTable;
+			std::vector<Cooked::meshLevel> levelTable;
+			std::string strings;
+			std::vector<std::pair<const void*, size_t>> streams;
+			for (auto& [name, model] : models) {
+				modelTable.push_back({ (uint32_t)strings.size(), (uint32_t)name.size(), (uint32_t)levelTable.size(), (uint32_t)model.lodLevels() });
+				strings += name;
+				for (size_t level = 0; level < model.lodLevels(); level++) {
+					Element::mesh& mesh = model.lod(level);
+					uint32_t vertexCount = (uint32_t)(mesh.vertacies.size() / 3);
+					if (mesh.colors.size() != vertexCount * 4 || (!mesh.uvs.empty() && mesh.uvs.size() != vertexCount * 2)) {
+						std::cerr << "Can't save model " << name << ": level " << level << " has a color or UV per vertex missing" << std::endl;
+						return false;
+					}
+					Cooked::meshLevel record = {};
+					record.screenSize = level ? model.lodScreenSize[level - 1] : 0.0f;
+					record.vertexCount = vertexCount;
+					record.indexCount = (uint32_t)mesh.indices.size();
+					record.textured = !mesh.uvs.empty();
+					glm::vec4 sphere = mesh.boundingSphere();
+					glm::vec3 min, max;
+					mesh.boundingBox(min, max);
+					std::memcpy(record.sphere, glm::value_ptr(sphere), sizeof(record.sphere));
+					std::memcpy(record.min, glm::value_ptr(min), sizeof(record.min));
+					std::memcpy(record.max, glm::value_ptr(max), sizeof(record.max));
+					record.translucent = mesh.translucent();
+					levelTable.push_back(record);
+					streams.push_back({ mesh.vertacies.data(), mesh.vertacies.size() * sizeof(GLfloat) });
+					streams.push_back({ mesh.colors.data(), mesh.colors.size() * sizeof(GLfloat) });
+					streams.push_back({ mesh.uvs.data(), mesh.uvs.size() * sizeof(GLfloat) });
+					streams.push_back({ mesh.indices.data(), mesh.indices.size() * sizeof(GLuint) });
+				}
+			}
+
+			Cooked::meshHeader header = {};
+			header.magic = Cooked::meshMagic;
+			header.version = Cooked::meshVersion;
+			header.models = (uint32_t)modelTable.size();
+			header.levels = (uint32_t)levelTable.size();
+			header.source = source;
+			header.modelTable = sizeof(header);
+			header.levelTable = header.modelTable + sizeof(Cooked::meshModel) * modelTable.size();
+			header.strings = header.levelTable + sizeof(Cooked::meshLevel) * levelTable.size();
+			header.stringsSize = strings.size();
+			uint64_t offset = align16(header.strings + header.stringsSize);
+			std::vector<uint64_t> streamOffsets(streams.size());
+			for (size_t i = 0; i < streams.size(); i++) {
+				streamOffsets[i] = offset;
+				offset = align16(offset + streams[i].second);
+			}
+			for (size_t level = 0; level < levelTable.size(); level++) {
+				levelTable[level].positions = streamOffsets[level * 4];
+				levelTable[level].colors = streamOffsets[level * 4 + 1];
+				levelTable[level].uvs = streamOffsets[level * 4 + 2];
+				levelTable[level].indices = streamOffsets[level * 4 + 3];
+			}
+
+			// written next to the file and renamed over it, a failed save leaves the old file alone
+			std::string temporary = path + ".tmp";
+			{
+				std::ofstream file(temporary, std::ios::binary);
+				file.write((const char*)&header, sizeof(header));
+				file.write((const char*)modelTable.data(), sizeof(Cooked::meshModel) * modelTable.size());
+				file.write((const char*)levelTable.data(), sizeof(Cooked::meshLevel) * levelTable.size());
+				file.write(strings.data(), strings.size());
+				uint64_t written = header.strings + header.stringsSize;
+				const char padding[16] = {};
+				for (size_t i = 0; i < streams.size(); i++) {
+					file.write(padding, streamOffsets[i] - written);
+					file.write((const char*)streams[i].first, streams[i].second);
+					written = streamOffsets[i] + streams[i].second;
+				}
+				file.write(padding, offset - written);
+				if (!file) {
+					std::cerr << "Failed to write " << temporary << std::endl;
+					file.close();
+					std::remove(temporary.c_str());
+					return false;
+				}
+			}
+			std::remove(path.c_str());
+			if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+				std::cerr << "Failed to replace " << path << std::endl;
+				std::remove(temporary.c_str());
+				return false;
+			}
+			return true;
+		}
+		bool modelStorage::load(const std::string& path, uint64_t source) {
+			mappedFile file(path);
+			// no file is the usual first run, only a broken one is worth a message
+			if (!file.data)
+				return false;
+			Cooked::meshHeader header;
+			if (file.size < sizeof(header)) {
+				std::cerr << "Failed to load models from " << path << ": file is truncated" << std::endl;
+				return false;
+			}
+			std::memcpy(&header, file.data, sizeof(header));
+			if (header.magic != Cooked::meshMagic) {
+				std::cerr << "Failed to load models from " << path << ": not a model file" << std::endl;
+				return false;
+			}
+			if (header.version != Cooked::meshVersion) {
+				std::cerr << "Failed to load models from " << path << ": version " << header.version << ", expected " << Cooked::meshVersion << std::endl;
+				return false;
+			}
+			if (header.source != source) {
+				std::cerr << "Failed to load models from " << path << ": built from other inputs" << std::endl;
+				return false;
+			}
+			if (!inside(file, header.modelTable, header.models, sizeof(Cooked::meshModel)) ||
+				!inside(file, header.levelTable, header.levels, sizeof(Cooked::meshLevel)) ||
+				!inside(file, header.strings, header.stringsSize, 1) ||
+				header.modelTable % 8 || header.levelTable % 8) {
+				std::cerr << "Failed to load models from " << path << ": tables are outside the file" << std::endl;
+				return false;
+			}
+			const Cooked::meshModel* modelTable = (const Cooked::meshModel*)(file.data + header.modelTable);
+			const Cooked::meshLevel* levelTable = (const Cooked::meshLevel*)(file.data + header.levelTable);
+			const char* strings = (const char*)(file.data + header.strings);
+
+			// everything is checked before the first model is touched, a bad file changes nothing
+			for (uint32_t i = 0; i < header.models; i++) {
+				const Cooked::meshModel& record = modelTable[i];
+				bool valid = (uint64_t)record.name + record.nameLength <= header.stringsSize && record.levelCount > 0 &&
+					(uint64_t)record.firstLevel + record.levelCount <= header.levels;
+				for (uint32_t level = 0; valid && level < record.levelCount; level++) {
+					const Cooked::meshLevel& lod = levelTable[record.firstLevel + level];
+					valid = lod.positions % 16 == 0 && lod.colors % 16 == 0 && lod.uvs % 16 == 0 && lod.indices % 16 == 0 &&
+						inside(file, lod.positions, (uint64_t)lod.vertexCount * 3, sizeof(GLfloat)) &&
+						inside(file, lod.colors, (uint64_t)lod.vertexCount * 4, sizeof(GLfloat)) &&
+						inside(file, lod.uvs, lod.textured ? (uint64_t)lod.vertexCount * 2 : 0, sizeof(GLfloat)) &&
+						inside(file, lod.indices, lod.indexCount, sizeof(GLuint));
+					// an index past the vertices would read outside the vertex buffer once it's drawn
+					const GLuint* indices = (const GLuint*)(file.data + lod.indices);
+					for (uint32_t index = 0; valid && index < lod.indexCount; index++)
+						valid = indices[index] < lod.vertexCount;
+				}
+				if (!valid) {
+					std::cerr << "Failed to load models from " << path << ": model " << i << " points outside the file or its vertices" << std::endl;
+					return false;
+				}
+			}
+
+			for (uint32_t i = 0; i < header.models; i++) {
+				const Cooked::meshModel& record = modelTable[i];
+				model& model = models[std::string(strings + record.name, record.nameLength)];
+				model.lods.resize(record.levelCount - 1);
+				model.lodScreenSize.resize(record.levelCount - 1);
+				for (uint32_t level = 0; level < record.levelCount; level++) {
+					const Cooked::meshLevel& lod = levelTable[record.firstLevel + level];
+					Element::mesh& mesh = model.lod(level);
+					const GLfloat* positions = (const GLfloat*)(file.data + lod.positions);
+					const GLfloat* colors = (const GLfloat*)(file.data + lod.colors);
+					const GLfloat* uvs = (const GLfloat*)(file.data + lod.uvs);
+					const GLuint* indices = (const GLuint*)(file.data + lod.indices);
+					mesh.vertacies.assign(positions, positions + (size_t)lod.vertexCount * 3);
+					mesh.colors.assign(colors, colors + (size_t)lod.vertexCount * 4);
+					mesh.uvs.assign(uvs, uvs + (lod.textured ? (size_t)lod.vertexCount * 2 : 0));
+					mesh.indices.assign(indices, indices + lod.indexCount);
+					mesh.colDebug.clear();
+					mesh.revision++;
+					mesh.setBounds(glm::make_vec4(lod.sphere), glm::make_vec3(lod.min), glm::make_vec3(lod.max), lod.translucent != 0);
+					if (level)
+						model.lodScreenSize[level - 1] = lod.screenSize;
+				}
+			}
+			return true;
+		}
+	}
+}
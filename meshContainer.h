@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// binary model file, written by modelStorage::save and mapped by modelStorage::load (meshAsset.cpp):
+// a header, the model table, the level table, the string table with the model names, then the streams.
+// Every stream starts 16 byte aligned so it can be copied or uploaded from the mapped pages as it is
+namespace Cooked {
+    constexpr uint32_t meshMagic = 0x48534D45; // "EMSH"
+    constexpr uint32_t meshVersion = 2;
+
+    struct meshHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t models;
+        uint32_t levels;
+        // modelStorage::sourceHash of what the models were built from, a file from other inputs is rebuilt
+        uint64_t source;
+        // offsets from the start of the file
+        uint64_t modelTable;
+        uint64_t levelTable;
+        uint64_t strings;
+        uint64_t stringsSize;
+    };
+    struct meshModel {
+        // name in the string table, not null terminated
+        uint32_t name;
+        uint32_t nameLength;
+        // levels of detail firstLevel .. firstLevel + levelCount in the level table, level 0 first
+        uint32_t firstLevel;
+        uint32_t levelCount;
+    };
+    struct meshLevel {
+        // screen height fraction below which the level is drawn, 0 for level 0
+        float screenSize;
+        uint32_t vertexCount;
+        uint32_t indexCount;
+        // 1 when the level has a UV stream
+        uint32_t textured;
+        // bounds as mesh::boundingSphere / boundingBox / translucent report them
+        float sphere[4];
+        float min[3];
+        float max[3];
+        uint32_t translucent;
+        uint32_t padding;
+        // 3 floats position, 4 floats color and 2 floats UV per vertex, 1 uint per index
+        uint64_t positions;
+        uint64_t colors;
+        uint64_t uvs;
+        uint64_t indices;
+    };
+}
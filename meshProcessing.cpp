@@ -0,0 +1,537 @@
+#include "framework.h"
+#include "Include.h"
+
+#include <unordered_map>
+#include <queue>
+
+namespace Element {
+	namespace {
+		// position, color and UV of one vertex, compared bit for bit
+		struct weldKey {
+			GLfloat values[9];
+
+			bool operator==(const weldKey& other) const {
+				return std::memcmp(values, other.values, sizeof(values)) == 0;
+			}
+		};
+		struct weldHash {
+			size_t operator()(const weldKey& key) const {
+				// FNV-1a over the raw bytes
+				const unsigned char* bytes = reinterpret_cast<const unsigned char*>(key.values);
+				size_t hash = 14695981039346656037ull;
+				for (size_t i = 0; i < sizeof(key.values); i++) {
+					hash ^= bytes[i];
+					hash *= 1099511628211ull;
+				}
+				return hash;
+			}
+		};
+
+		// Tipsify (Sander, Nehab, Barczak 2007): fans around the vertex most likely to still be in
+		// the cache, clusters start wherever it has to jump to a new part of the mesh
+		std::vector<GLuint> tipsify(const std::vector<GLuint>& indices, size_t vertexCount, int cacheSize, std::vector<size_t>& clusters) {
+			size_t triangleCount = indices.size() / 3;
+
+			// triangles using every vertex
+			std::vector<GLuint> adjacencyOffset(vertexCount + 1, 0);
+			for (GLuint index : indices)
+				adjacencyOffset[index + 1]++;
+			for (size_t i = 0; i < vertexCount; i++)
+				adjacencyOffset[i + 1] += adjacencyOffset[i];
+			std::vector<GLuint> adjacency(indices.size());
+			std::vector<GLuint> cursor(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+			for (size_t i = 0; i < indices.size(); i++)
+				adjacency[cursor[indices[i]]++] = i / 3;
+
+			std::vector<int> liveTriangles(vertexCount);
+			for (size_t i = 0; i < vertexCount; i++)
+				liveTriangles[i] = adjacencyOffset[i + 1] - adjacencyOffset[i];
+
+			std::vector<int> cacheTime(vertexCount, 0);
+			std::vector<bool> emitted(triangleCount, false);
+			std::vector<GLuint> deadEnd;
+			std::vector<GLuint> candidates;
+			std::vector<GLuint> output;
+			output.reserve(indices.size());
+
+			int time = cacheSize + 1;
+			size_t scan = 0;
+			int fanning = vertexCount ? 0 : -1;
+			clusters.assign(1, 0);
+			while (fanning >= 0) {
+				candidates.clear();
+				for (GLuint a = adjacencyOffset[fanning]; a < adjacencyOffset[fanning + 1]; a++) {
+					GLuint triangle = adjacency[a];
+					if (emitted[triangle])
+						continue;
+					for (int corner = 0; corner < 3; corner++) {
+						GLuint vertex = indices[triangle * 3 + corner];
+						output.push_back(vertex);
+						deadEnd.push_back(vertex);
+						candidates.push_back(vertex);
+						liveTriangles[vertex]--;
+						if (time - cacheTime[vertex] > cacheSize)
+							cacheTime[vertex] = time++;
+					}
+					emitted[triangle] = true;
+				}
+
+				// the candidate that stays in the cache longest after its remaining triangles are emitted
+				int best = -1;
+				int bestPriority = -1;
+				for (GLuint vertex : candidates) {
+					if (liveTriangles[vertex] <= 0)
+						continue;
+					int priority = 0;
+					if (time - cacheTime[vertex] + 2 * liveTriangles[vertex] <= cacheSize)
+						priority = time - cacheTime[vertex];
+					if (priority > bestPriority) {
+						bestPriority = priority;
+						best = vertex;
+					}
+				}
+				if (best == -1) {
+					// dead end, go back to a recently used vertex or scan for any unfinished one
+					while (!deadEnd.empty() && best == -1) {
+						GLuint vertex = deadEnd.back();
+						deadEnd.pop_back();
+						if (liveTriangles[vertex] > 0)
+							best = vertex;
+					}
+					while (best == -1 && scan < vertexCount) {
+						if (liveTriangles[scan] > 0)
+							best = scan;
+						scan++;
+					}
+					if (best != -1 && output.size() / 3 != clusters.back())
+						clusters.push_back(output.size() / 3);
+				}
+				fanning = best;
+			}
+			return output;
+		}
+
+		// Garland and Heckbert 1998: squared distance to the planes of triangles in position + color space,
+		// only the upper half of the symmetric 7x7 matrix is stored
+		struct quadric {
+			double a[28] = {};
+			double b[7] = {};
+			double c = 0;
+
+			void addTriangle(const double* p1, const double* p2, const double* p3) {
+				// orthonormal e1, e2 spanning the triangle, A = I - e1 e1' - e2 e2'
+				double e1[7], e2[7];
+				double dot12 = 0, length1 = 0, length2 = 0;
+				for (int i = 0; i < 7; i++) {
+					e1[i] = p2[i] - p1[i];
+					length1 += e1[i] * e1[i];
+				}
+				if (length1 <= 0)
+					return;
+				length1 = std::sqrt(length1);
+				for (int i = 0; i < 7; i++) {
+					e1[i] /= length1;
+					dot12 += e1[i] * (p3[i] - p1[i]);
+				}
+				for (int i = 0; i < 7; i++) {
+					e2[i] = p3[i] - p1[i] - dot12 * e1[i];
+					length2 += e2[i] * e2[i];
+				}
+				if (length2 <= 0)
+					return;
+				length2 = std::sqrt(length2);
+				double p1e1 = 0, p1e2 = 0, p1p1 = 0;
+				for (int i = 0; i < 7; i++) {
+					e2[i] /= length2;
+					p1e1 += p1[i] * e1[i];
+					p1e2 += p1[i] * e2[i];
+					p1p1 += p1[i] * p1[i];
+				}
+				for (int i = 0, k = 0; i < 7; i++) {
+					for (int j = i; j < 7; j++, k++)
+						a[k] += (i == j ? 1 : 0) - e1[i] * e1[j] - e2[i] * e2[j];
+					b[i] += p1e1 * e1[i] + p1e2 * e2[i] - p1[i];
+				}
+				c += p1p1 - p1e1 * p1e1 - p1e2 * p1e2;
+			}
+			void add(const quadric& other) {
+				for (int k = 0; k < 28; k++)
+					a[k] += other.a[k];
+				for (int i = 0; i < 7; i++)
+					b[i] += other.b[i];
+				c += other.c;
+			}
+			// v' A v + 2 b.v + c
+			double error(const double* v) const {
+				double sum = c;
+				for (int i = 0, k = 0; i < 7; i++) {
+					sum += a[k++] * v[i] * v[i];
+					for (int j = i + 1; j < 7; j++)
+						sum += 2 * a[k++] * v[i] * v[j];
+					sum += 2 * b[i] * v[i];
+				}
+				return sum;
+			}
+		};
+		struct collapse {
+			double error = DBL_MAX;
+			GLuint from = 0;
+			GLuint to = 0;
+			// filled in once the cheaper direction is known
+			GLuint fromVersion = 0;
+			GLuint toVersion = 0;
+
+			bool operator>(const collapse& other) const {
+				return error > other.error;
+			}
+		};
+	}
+
+	void mesh::weld() {
+		size_t vertexCount = vertacies.size() / 3;
+		if (indices.empty()) {
+			indices.resize(vertexCount);
+			std::iota(indices.begin(), indices.end(), 0);
+		}
+
+		bool hasUVs = uvs.size() == vertexCount * 2;
+		std::unordered_map<weldKey, GLuint, weldHash> unique;
+		unique.reserve(vertexCount);
+		std::vector<GLuint> remap(vertexCount);
+		std::vector<GLfloat> newVertacies;
+		std::vector<GLfloat> newColors;
+		std::vector<GLfloat> newUVs;
+		newVertacies.reserve(vertacies.size());
+		newColors.reserve(colors.size());
+		for (size_t i = 0; i < vertexCount; i++) {
+			weldKey key = {};
+			std::copy(vertacies.begin() + i * 3, vertacies.begin() + i * 3 + 3, key.values);
+			std::copy(colors.begin() + i * 4, colors.begin() + i * 4 + 4, key.values + 3);
+			if (hasUVs)
+				std::copy(uvs.begin() + i * 2, uvs.begin() + i * 2 + 2, key.values + 7);
+			auto [entry, inserted] = unique.emplace(key, (GLuint)(newVertacies.size() / 3));
+			if (inserted) {
+				newVertacies.insert(newVertacies.end(), key.values, key.values + 3);
+				newColors.insert(newColors.end(), key.values + 3, key.values + 7);
+				if (hasUVs)
+					newUVs.insert(newUVs.end(), key.values + 7, key.values + 9);
+			}
+			remap[i] = entry->second;
+		}
+		for (GLuint& index : indices)
+			index = remap[index];
+
+		vertacies = std::move(newVertacies);
+		colors = std::move(newColors);
+		uvs = std::move(newUVs);
+		revision++;
+	}
+	void mesh::optimize(int cacheSize) {
+		if (indices.empty())
+			weld();
+		size_t vertexCount = vertacies.size() / 3;
+		if (indices.size() < 3)
+			return;
+
+		std::vector<size_t> clusters;
+		std::vector<GLuint> ordered = tipsify(indices, vertexCount, cacheSize, clusters);
+		size_t triangleCount = ordered.size() / 3;
+		clusters.push_back(triangleCount);
+
+		// overdraw: clusters facing away from the mesh center are likely to occlude the rest, draw them first
+		auto position = [&](GLuint vertex) {
+			return glm::vec3(vertacies[vertex * 3], vertacies[vertex * 3 + 1], vertacies[vertex * 3 + 2]);
+		};
+		glm::vec3 meshCenter = glm::vec3(boundingSphere());
+		std::vector<std::pair<float, size_t>> order;
+		for (size_t c = 0; c + 1 < clusters.size(); c++) {
+			glm::vec3 center = glm::vec3(0);
+			glm::vec3 normal = glm::vec3(0);
+			float area = 0;
+			for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+				glm::vec3 a = position(ordered[t * 3]);
+				glm::vec3 b = position(ordered[t * 3 + 1]);
+				glm::vec3 d = position(ordered[t * 3 + 2]);
+				glm::vec3 cross = glm::cross(b - a, d - a);
+				float triangleArea = glm::length(cross);
+				center += (a + b + d) / 3.0f * triangleArea;
+				normal += cross;
+				area += triangleArea;
+			}
+			if (area > 0)
+				center /= area;
+			float length = glm::length(normal);
+			if (length > 0)
+				normal /= length;
+			order.push_back({ glm::dot(center - meshCenter, normal), c });
+		}
+		std::stable_sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+		indices.clear();
+		for (auto& [occlusion, c] : order)
+			indices.insert(indices.end(), ordered.begin() + clusters[c] * 3, ordered.begin() + clusters[c + 1] * 3);
+
+		// vertex fetch: store vertices in the order the triangles first use them
+		bool hasUVs = uvs.size() == vertexCount * 2;
+		std::vector<GLuint> remap(vertexCount, UINT32_MAX);
+		std::vector<GLfloat> newVertacies;
+		std::vector<GLfloat> newColors;
+		std::vector<GLfloat> newUVs;
+		newVertacies.reserve(vertacies.size());
+		newColors.reserve(colors.size());
+		GLuint next = 0;
+		for (GLuint& index : indices) {
+			if (remap[index] == UINT32_MAX) {
+				remap[index] = next++;
+				newVertacies.insert(newVertacies.end(), vertacies.begin() + index * 3, vertacies.begin() + index * 3 + 3);
+				newColors.insert(newColors.end(), colors.begin() + index * 4, colors.begin() + index * 4 + 4);
+				if (hasUVs)
+					newUVs.insert(newUVs.end(), uvs.begin() + index * 2, uvs.begin() + index * 2 + 2);
+			}
+			index = remap[index];
+		}
+		vertacies = std::move(newVertacies);
+		colors = std::move(newColors);
+		uvs = std::move(newUVs);
+		revision++;
+	}
+	void mesh::simplify(size_t targetTriangles, float maxError) {
+		if (indices.empty())
+			weld();
+		size_t vertexCount = vertacies.size() / 3;
+
+		// positions relative to the bounding sphere, so errors are fractions of its radius, a full
+		// color channel step weighs as much as the radius
+		glm::vec4 sphere = boundingSphere();
+		double radius = sphere.w > 0 ? sphere.w : 1;
+		std::vector<std::array<double, 7>> points(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++) {
+			for (int axis = 0; axis < 3; axis++)
+				points[v][axis] = (vertacies[v * 3 + axis] - sphere[axis]) / radius;
+			for (int channel = 0; channel < 4; channel++)
+				points[v][3 + channel] = colors[v * 4 + channel];
+		}
+
+		// vertices sharing a position with another color or UV sit on a seam, edges used once are open borders,
+		// both are locked so seams and outlines keep their shape
+		std::unordered_map<weldKey, GLuint, weldHash> positions;
+		std::vector<GLuint> group(vertexCount);
+		std::vector<GLuint> groupSize;
+		for (size_t v = 0; v < vertexCount; v++) {
+			weldKey key = {};
+			std::copy(vertacies.begin() + v * 3, vertacies.begin() + v * 3 + 3, key.values);
+			auto [entry, inserted] = positions.emplace(key, (GLuint)groupSize.size());
+			if (inserted)
+				groupSize.push_back(0);
+			group[v] = entry->second;
+			groupSize[group[v]]++;
+		}
+		std::vector<GLuint> live;
+		for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+			if (indices[t] != indices[t + 1] && indices[t + 1] != indices[t + 2] && indices[t] != indices[t + 2])
+				live.insert(live.end(), { indices[t], indices[t + 1], indices[t + 2] });
+		}
+		size_t triangleCount = live.size() / 3;
+		std::unordered_map<uint64_t, GLuint> edgeUses;
+		for (size_t t = 0; t < triangleCount; t++) {
+			for (int corner = 0; corner < 3; corner++) {
+				uint64_t a = group[live[t * 3 + corner]];
+				uint64_t b = group[live[t * 3 + (corner + 1) % 3]];
+				edgeUses[std::min(a, b) << 32 | std::max(a, b)]++;
+			}
+		}
+		std::vector<bool> lockedGroup(groupSize.size());
+		for (auto& [edge, uses] : edgeUses) {
+			if (uses == 1) {
+				lockedGroup[edge >> 32] = true;
+				lockedGroup[edge & 0xFFFFFFFF] = true;
+			}
+		}
+		std::vector<bool> locked(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++)
+			locked[v] = groupSize[group[v]] > 1 || lockedGroup[group[v]];
+
+		std::vector<quadric> quadrics(vertexCount);
+		std::vector<std::vector<GLuint>> vertexTriangles(vertexCount);
+		for (size_t t = 0; t < triangleCount; t++) {
+			quadric triangle;
+			triangle.addTriangle(points[live[t * 3]].data(), points[live[t * 3 + 1]].data(), points[live[t * 3 + 2]].data());
+			for (int corner = 0; corner < 3; corner++) {
+				quadrics[live[t * 3 + corner]].add(triangle);
+				vertexTriangles[live[t * 3 + corner]].push_back(t);
+			}
+		}
+
+		// every vertex moves onto one of its neighbours, so no new vertices are made and the
+		// cheaper direction of an edge is the one queued
+		std::vector<GLuint> version(vertexCount, 0);
+		std::vector<bool> removed(vertexCount, false);
+		std::vector<bool> deadTriangle(triangleCount, false);
+		std::priority_queue<collapse, std::vector<collapse>, std::greater<collapse>> heap;
+		auto queueEdge = [&](GLuint a, GLuint b) {
+			collapse best;
+			if (!locked[a])
+				best = { quadrics[a].error(points[b].data()) + quadrics[b].error(points[b].data()), a, b };
+			if (!locked[b]) {
+				double error = quadrics[a].error(points[a].data()) + quadrics[b].error(points[a].data());
+				if (error < best.error)
+					best = { error, b, a };
+			}
+			if (best.error == DBL_MAX)
+				return;
+			best.fromVersion = version[best.from];
+			best.toVersion = version[best.to];
+			heap.push(best);
+		};
+		for (size_t t = 0; t < triangleCount; t++) {
+			for (int corner = 0; corner < 3; corner++) {
+				GLuint a = live[t * 3 + corner];
+				GLuint b = live[t * 3 + (corner + 1) % 3];
+				// the neighbouring triangle has the edge the other way around, borders are locked anyway
+				if (a < b)
+					queueEdge(a, b);
+			}
+		}
+
+		// moving from onto to must not turn any of the remaining triangles around
+		auto position = [&](GLuint vertex) {
+			return glm::vec3(vertacies[vertex * 3], vertacies[vertex * 3 + 1], vertacies[vertex * 3 + 2]);
+		};
+		auto flips = [&](GLuint from, GLuint to) {
+			for (GLuint t : vertexTriangles[from]) {
+				if (deadTriangle[t])
+					continue;
+				glm::vec3 corners[3], moved[3];
+				bool shared = false;
+				for (int corner = 0; corner < 3; corner++) {
+					GLuint vertex = live[t * 3 + corner];
+					shared |= vertex == to;
+					corners[corner] = position(vertex);
+					moved[corner] = vertex == from ? position(to) : corners[corner];
+				}
+				if (shared)
+					continue;
+				glm::vec3 before = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+				glm::vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+				if (glm::dot(before, after) <= 0)
+					return true;
+			}
+			return false;
+		};
+
+		double errorLimit = maxError < FLT_MAX ? (double)maxError * maxError : DBL_MAX;
+		size_t remaining = triangleCount;
+		while (remaining > targetTriangles && !heap.empty()) {
+			collapse next = heap.top();
+			heap.pop();
+			if (next.error > errorLimit)
+				break;
+			if (removed[next.from] || removed[next.to] || version[next.from] != next.fromVersion || version[next.to] != next.toVersion)
+				continue;
+			if (flips(next.from, next.to))
+				continue;
+
+			for (GLuint t : vertexTriangles[next.from]) {
+				if (deadTriangle[t])
+					continue;
+				GLuint* triangle = live.data() + t * 3;
+				if (triangle[0] == next.to || triangle[1] == next.to || triangle[2] == next.to) {
+					deadTriangle[t] = true;
+					remaining--;
+					continue;
+				}
+				for (int corner = 0; corner < 3; corner++) {
+					if (triangle[corner] == next.from)
+						triangle[corner] = next.to;
+				}
+				vertexTriangles[next.to].push_back(t);
+			}
+			quadrics[next.to].add(quadrics[next.from]);
+			removed[next.from] = true;
+			version[next.to]++;
+			vertexTriangles[next.from].clear();
+
+			for (GLuint t : vertexTriangles[next.to]) {
+				if (deadTriangle[t])
+					continue;
+				for (int corner = 0; corner < 3; corner++) {
+					if (live[t * 3 + corner] != next.to)
+						queueEdge(live[t * 3 + corner], next.to);
+				}
+			}
+		}
+
+		// surviving triangles in their old order, vertices by first use
+		bool hasUVs = uvs.size() == vertexCount * 2;
+		std::vector<GLuint> remap(vertexCount, UINT32_MAX);
+		std::vector<GLfloat> newVertacies;
+		std::vector<GLfloat> newColors;
+		std::vector<GLfloat> newUVs;
+		indices.clear();
+		GLuint next = 0;
+		for (size_t t = 0; t < triangleCount; t++) {
+			if (deadTriangle[t])
+				continue;
+			for (int corner = 0; corner < 3; corner++) {
+				GLuint index = live[t * 3 + corner];
+				if (remap[index] == UINT32_MAX) {
+					remap[index] = next++;
+					newVertacies.insert(newVertacies.end(), vertacies.begin() + index * 3, vertacies.begin() + index * 3 + 3);
+					newColors.insert(newColors.end(), colors.begin() + index * 4, colors.begin() + index * 4 + 4);
+					if (hasUVs)
+						newUVs.insert(newUVs.end(), uvs.begin() + index * 2, uvs.begin() + index * 2 + 2);
+				}
+				indices.push_back(remap[index]);
+			}
+		}
+		vertacies = std::move(newVertacies);
+		colors = std::move(newColors);
+		uvs = std::move(newUVs);
+		revision++;
+	}
+
+	// model --
+	void model::generateLODs(int levels, float screenSize, float maxError) {
+		lods.clear();
+		lodScreenSize.clear();
+		size_t triangles = (mesh.indices.empty() ? mesh.vertacies.size() / 3 : mesh.indices.size()) / 3;
+		for (int level = 1; level < levels; level++) {
+			// each level starts from the one before, the quadrics only see what is left of the mesh
+			Element::mesh simplified = lod(level - 1);
+			simplified.simplify(triangles / 2, maxError);
+			size_t count = simplified.indices.size() / 3;
+			if (count == 0 || count > triangles * 9 / 10)
+				break;
+			simplified.optimize();
+			lods.push_back(std::move(simplified));
+			lodScreenSize.push_back(screenSize);
+			screenSize /= 2;
+			triangles = count;
+		}
+	}
+
+	namespace Storage {
+		// modelStorage --
+		void modelStorage::generateLODs(int levels, float screenSize, float maxError, unsigned threads) {
+			std::vector<model*> pending;
+			for (auto& [name, model] : models)
+				pending.push_back(&model);
+			if (!threads)
+				threads = std::max(std::thread::hardware_concurrency(), 1u);
+			threads = (unsigned)std::min<size_t>(threads, pending.size());
+
+			// models are independent, every worker takes the next one until none are left
+			std::atomic<size_t> next = 0;
+			auto work = [&]() {
+				for (size_t i = next++; i < pending.size(); i = next++)
+					pending[i]->generateLODs(levels, screenSize, maxError);
+			};
+			std::vector<std::thread> workers;
+			for (unsigned i = 1; i < threads; i++)
+				workers.emplace_back(work);
+			work();
+			for (std::thread& worker : workers)
+				worker.join();
+		}
+	}
+}
@@ -0,0 +1,55 @@
+#include "framework.h"
+#include "Include.h"
+
+namespace Element {
+	// renderQueue --
+	uint64_t renderQueue::key(uint8_t layer, bool translucent, uint16_t program, uint16_t material, float depth) {
+		// positive floats sort like their bits, the lowest bit is dropped to fit 30
+		uint32_t depthBits;
+		float clamped = std::max(depth, 0.0f);
+		std::memcpy(&depthBits, &clamped, sizeof(depthBits));
+		uint64_t distance = depthBits >> 1;
+
+		uint64_t key = (uint64_t)layer << 56 | (translucent ? translucentBit : 0);
+		if (translucent)
+			key |= (~distance & depthMask) << 25 | (uint64_t)(program & programMask) << 15 | (material & materialMask);
+		else
+			key |= (uint64_t)(program & programMask) << 45 | (uint64_t)(material & materialMask) << 30 | distance;
+		return key;
+	}
+	void renderQueue::sort() {
+		size_t count = items.size();
+		if (count < 2)
+			return;
+
+		// every byte's histogram in one read of the keys
+		size_t histograms[8][256] = {};
+		for (const item& item : items) {
+			for (int byte = 0; byte < 8; byte++)
+				histograms[byte][(item.key >> (byte * 8)) & 0xFF]++;
+		}
+
+		scratch.resize(count);
+		item* source = items.data();
+		item* destination = scratch.data();
+		for (int byte = 0; byte < 8; byte++) {
+			size_t* histogram = histograms[byte];
+			// a byte every key shares doesn't change the order
+			if (histogram[(source[0].key >> (byte * 8)) & 0xFF] == count)
+				continue;
+
+			size_t offsets[256];
+			size_t total = 0;
+			for (int bucket = 0; bucket < 256; bucket++) {
+				offsets[bucket] = total;
+				total += histogram[bucket];
+			}
+			for (size_t i = 0; i < count; i++)
+				destination[offsets[(source[i].key >> (byte * 8)) & 0xFF]++] = source[i];
+			std::swap(source, destination);
+		}
+		// an odd number of passes leaves the result in scratch
+		if (source != items.data())
+			items.swap(scratch);
+	}
+}
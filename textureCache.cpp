@@ -0,0 +1,166 @@
+#include "framework.h"
+#include "Include.h"
+
+#include <filesystem>
+
+namespace Element {
+	namespace {
+		constexpr uint32_t cacheMagic = 0x48434554; // "TECH"
+		constexpr uint32_t cacheVersion = 1;
+		// the pixels start on their own page, the header and the source path fill the first one
+		constexpr uint64_t cacheDataOffset = 4096;
+
+		struct cacheHeader {
+			uint32_t magic;
+			uint32_t version;
+			int64_t sourceTime;
+			uint64_t sourceSize;
+			uint64_t contentHash;
+			uint32_t width;
+			uint32_t height;
+			uint32_t format;
+			uint32_t levels;
+			uint64_t dataOffset;
+			uint64_t dataSize;
+			uint32_t pathLength;
+			uint32_t padding;
+		};
+
+		// 64 bit FNV-1a
+		uint64_t hashBytes(const unsigned char* bytes, size_t size, uint64_t hash = 14695981039346656037ull) {
+			for (size_t i = 0; i < size; i++) {
+				hash ^= bytes[i];
+				hash *= 1099511628211ull;
+			}
+			return hash;
+		}
+		uint64_t hashFile(const std::string& path) {
+			mappedFile file(path);
+			return hashBytes(file.data, file.size);
+		}
+		int64_t sourceTime(const std::string& path, std::error_code& error) {
+			return (int64_t)std::filesystem::last_write_time(path, error).time_since_epoch().count();
+		}
+	}
+
+	// texture --
+	const unsigned char* texture::texels() const {
+		return mapping ? mapping->data + mappedOffset : data.data();
+	}
+	size_t texture::bytes() const {
+		return mapping ? mappedSize : data.size();
+	}
+
+	// textureCache --
+	textureCache::textureCache(std::string directory) : directory(directory) {}
+	texture textureCache::load(const std::string& path) {
+		auto start = std::chrono::steady_clock::now();
+		std::string absolute = std::filesystem::absolute(path).lexically_normal().string();
+		char name[17];
+		std::snprintf(name, sizeof(name), "%016llx", (unsigned long long)hashBytes((const unsigned char*)absolute.data(), absolute.size()));
+		std::string entry = directory + "/" + name + ".tcache";
+
+		texture texture;
+		if (read(entry, absolute, texture)) {
+			hits++;
+			hitNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+			return texture;
+		}
+		texture = Element::texture(path);
+		// a failed decode leaves the 1x1 white default, which isn't worth an entry either way
+		if (texture.bytes() > 4)
+			write(entry, absolute, texture);
+		misses++;
+		missNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		return texture;
+	}
+	bool textureCache::read(const std::string& entry, const std::string& path, texture& texture) {
+		std::error_code error;
+		int64_t time = sourceTime(path, error);
+		uint64_t size = error ? 0 : (uint64_t)std::filesystem::file_size(path, error);
+		if (error)
+			return false;
+
+		auto mapping = std::make_shared<mappedFile>(entry);
+		cacheHeader header;
+		if (mapping->size < cacheDataOffset)
+			return false;
+		std::memcpy(&header, mapping->data, sizeof(header));
+		if (header.magic != cacheMagic || header.version != cacheVersion || header.sourceSize != size ||
+			header.pathLength != path.size() || sizeof(header) + header.pathLength > cacheDataOffset ||
+			path.compare(0, path.size(), (const char*)mapping->data + sizeof(header), header.pathLength) != 0 ||
+			header.dataOffset + header.dataSize > mapping->size || header.levels == 0)
+			return false;
+		if (header.sourceTime != time) {
+			// touched without changing, e.g. by a checkout, only the content hash tells
+			if (hashFile(path) != header.contentHash)
+				return false;
+			// the new time goes into the entry so the next run skips the hash, the mapping is closed first
+			// because Windows won't write a file with a view open
+			mapping.reset();
+			header.sourceTime = time;
+			std::fstream file(entry, std::ios::binary | std::ios::in | std::ios::out);
+			file.write((const char*)&header, sizeof(header));
+			file.close();
+			mapping = std::make_shared<mappedFile>(entry);
+			if (mapping->size < header.dataOffset + header.dataSize)
+				return false;
+		}
+
+		texture.width = header.width;
+		texture.height = header.height;
+		texture.channels = 4;
+		texture.format = header.format;
+		texture.levels = header.levels;
+		texture.data.clear();
+		texture.mapping = mapping;
+		texture.mappedOffset = header.dataOffset;
+		texture.mappedSize = header.dataSize;
+		return true;
+	}
+	void textureCache::write(const std::string& entry, const std::string& path, const texture& texture) {
+		std::error_code error;
+		std::filesystem::create_directories(directory, error);
+		cacheHeader header = {};
+		header.magic = cacheMagic;
+		header.version = cacheVersion;
+		header.sourceTime = sourceTime(path, error);
+		header.sourceSize = error ? 0 : (uint64_t)std::filesystem::file_size(path, error);
+		if (error || sizeof(header) + path.size() > cacheDataOffset)
+			return;
+		header.contentHash = hashFile(path);
+		header.width = texture.width;
+		header.height = texture.height;
+		header.format = texture.format;
+		header.levels = texture.levels;
+		header.dataOffset = cacheDataOffset;
+		header.dataSize = texture.bytes();
+		header.pathLength = (uint32_t)path.size();
+
+		// written next to the entry and renamed over it, so a reader never maps half an entry and
+		// threads loading the same path don't write into each other's file
+		std::string temporary = entry + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+		{
+			std::ofstream file(temporary, std::ios::binary);
+			std::vector<char> page(cacheDataOffset, 0);
+			std::memcpy(page.data(), &header, sizeof(header));
+			std::memcpy(page.data() + sizeof(header), path.data(), path.size());
+			file.write(page.data(), page.size());
+			file.write((const char*)texture.texels(), texture.bytes());
+			if (!file) {
+				std::cerr << "Failed to write texture cache entry " << temporary << std::endl;
+				file.close();
+				std::filesystem::remove(temporary, error);
+				return;
+			}
+		}
+		std::filesystem::rename(temporary, entry, error);
+		if (error)
+			std::filesystem::remove(temporary, error);
+	}
+	void textureCache::report(std::ostream& out) {
+		size_t warm = hits, cold = misses;
+		out << "Texture cache: " << warm << " warm loads (" << (warm ? hitNanoseconds / 1e6 / warm : 0.0) << " ms each), "
+			<< cold << " cold loads (" << (cold ? missNanoseconds / 1e6 / cold : 0.0) << " ms each)" << std::endl;
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// cooked texture container, written by the texture cooker (cooker.cpp) and read by Element::texture:
+// a header, one level entry per mip level, then the levels' texels or blocks from largest to 1x1
+namespace Cooked {
+    constexpr uint32_t magic = 0x58455445; // "ETEX"
+    constexpr uint32_t version = 1;
+
+    enum class blockFormat : uint32_t {
+        rgba8, // uncompressed, 4 bytes per texel
+        bc1,   // S3TC DXT1, 8 bytes per 4x4 block, opaque
+        bc3    // S3TC DXT5, 16 bytes per 4x4 block, BC1 colors and interpolated alpha
+    };
+
+    struct header {
+        uint32_t magic;
+        uint32_t version;
+        blockFormat format;
+        uint32_t width;
+        uint32_t height;
+        uint32_t levels;
+    };
+    // offset from the start of the file, levels are 16 byte aligned
+    struct level {
+        uint64_t offset;
+        uint64_t size;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    // bytes of one level, compressed levels are rounded up to whole 4x4 blocks
+    inline size_t levelSize(blockFormat format, uint32_t width, uint32_t height) {
+        size_t blocks = (size_t)((width + 3) / 4) * ((height + 3) / 4);
+        switch (format) {
+        case blockFormat::bc1:
+            return blocks * 8;
+        case blockFormat::bc3:
+            return blocks * 16;
+        default:
+            return (size_t)width * height * 4;
+        }
+    }
+    // number of levels down to 1x1
+    inline uint32_t levelCount(uint32_t width, uint32_t height) {
+        uint32_t levels = 1;
+        while ((width > height ? width : height) >> levels)
+            levels++;
+        return levels;
+    }
+}
@@ -0,0 +1,65 @@
+#include "framework.h"
+#include "Include.h"
+
+namespace Element {
+	// textureLoader --
+	textureLoader::textureLoader(unsigned threads) {
+		if (!threads)
+			threads = std::max(std::thread::hardware_concurrency(), 1u);
+		for (unsigned i = 0; i < threads; i++)
+			workers.emplace_back(&textureLoader::work, this);
+	}
+	textureLoader::~textureLoader() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+	void textureLoader::load(texture* target, const std::string& path) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back({ target, path });
+			loading++;
+		}
+		wake.notify_one();
+	}
+	size_t textureLoader::finish() {
+		std::vector<result> finished;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			finished.swap(results);
+			loading -= finished.size();
+		}
+		// the layers see the new revision and take the pixels to the texturePool on their next render()
+		for (result& result : finished) {
+			size_t revision = result.target->revision;
+			*result.target = std::move(result.decoded);
+			result.target->revision = revision + 1;
+		}
+		return finished.size();
+	}
+	size_t textureLoader::pending() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return loading;
+	}
+	void textureLoader::work() {
+		while (true) {
+			job job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+				if (stopping)
+					return;
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			// stb_image keeps no state between calls, the decode runs without the lock
+			texture decoded = cache ? cache->load(job.path) : texture(job.path);
+			std::lock_guard<std::mutex> lock(mutex);
+			results.push_back({ job.target, std::move(decoded) });
+		}
+	}
+}